@@ -0,0 +1,653 @@
+/*
+ * Copyright © 2008 Kristian Høgsberg
+ * Copyright © 2012 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * function 'blur_image' from weston project, split out of 'blur_surface':
+ * https://gitlab.freedesktop.org/wayland/weston/raw/master/shared/cairo-util.c
+ *
+ * This file must not depend on cairo, as it is also built into the native
+ * make-shadow-tile tool.
+ */
+
+#include "libdecor-cairo-blur-image.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_BLUR_X86 1
+#include <immintrin.h>
+#endif
+
+/* Radii up to the default one use the exact Gaussian kernel, larger ones the
+ * box blur approximation. */
+#define BLUR_MAX_GAUSSIAN_RADIUS BLUR_DEFAULT_RADIUS
+#define BLUR_KERNEL_SIZE (2 * BLUR_MAX_GAUSSIAN_RADIUS + 1)
+
+struct blur_kernel {
+	int size;
+	int half;
+	uint32_t sum;
+	uint32_t weights[BLUR_KERNEL_SIZE];
+	/* Weights of taps k and k + 1 packed as 16 bit pairs, with a zero
+	 * weight past the last tap, for pmaddwd. */
+	int32_t pairs[(BLUR_KERNEL_SIZE + 1) / 2];
+};
+
+static void
+init_blur_kernel(struct blur_kernel *kernel, int radius)
+{
+	int i, size, half;
+	uint32_t hi;
+	double f;
+
+	size = 2 * radius + 1;
+	half = radius;
+
+	kernel->size = size;
+	kernel->half = half;
+	kernel->sum = 0;
+	for (i = 0; i < size; i++) {
+		f = (i - half);
+		kernel->weights[i] = exp(- f * f / size) * 10000;
+		kernel->sum += kernel->weights[i];
+	}
+
+	for (i = 0; i < size; i += 2) {
+		hi = i + 1 < size ? kernel->weights[i + 1] : 0;
+		kernel->pairs[i / 2] = (int32_t) (kernel->weights[i] | hi << 16);
+	}
+}
+
+static inline bool
+is_copied_column(int j, int width, int margin)
+{
+	return margin < j && j < width - margin;
+}
+
+static inline bool
+is_copied_row(int i, int height, int margin)
+{
+	return margin <= i && i < height - margin;
+}
+
+static uint32_t
+blur_pixel_horizontal(const uint32_t *s, int width, int j,
+		      const struct blur_kernel *kernel)
+{
+	int32_t x, y, z, w;
+	uint32_t a, p;
+	int k;
+
+	a = kernel->sum;
+	x = 0;
+	y = 0;
+	z = 0;
+	w = 0;
+	for (k = 0; k < kernel->size; k++) {
+		if (j - kernel->half + k < 0 || j - kernel->half + k >= width)
+			continue;
+		p = s[j - kernel->half + k];
+
+		x += (p >> 24) * kernel->weights[k];
+		y += ((p >> 16) & 0xff) * kernel->weights[k];
+		z += ((p >> 8) & 0xff) * kernel->weights[k];
+		w += (p & 0xff) * kernel->weights[k];
+	}
+
+	return (x / a << 24) | (y / a << 16) | (z / a << 8) | w / a;
+}
+
+static uint32_t
+blur_pixel_vertical(const uint8_t *src, int height, int stride, int i, int j,
+		    const struct blur_kernel *kernel)
+{
+	int32_t x, y, z, w;
+	const uint32_t *s;
+	uint32_t a, p;
+	int k;
+
+	a = kernel->sum;
+	x = 0;
+	y = 0;
+	z = 0;
+	w = 0;
+	for (k = 0; k < kernel->size; k++) {
+		if (i - kernel->half + k < 0 || i - kernel->half + k >= height)
+			continue;
+		s = (const uint32_t *) (src + (i - kernel->half + k) * stride);
+		p = s[j];
+
+		x += (p >> 24) * kernel->weights[k];
+		y += ((p >> 16) & 0xff) * kernel->weights[k];
+		z += ((p >> 8) & 0xff) * kernel->weights[k];
+		w += (p & 0xff) * kernel->weights[k];
+	}
+
+	return (x / a << 24) | (y / a << 16) | (z / a << 8) | w / a;
+}
+
+static int
+blur_image_scalar(uint8_t *src, int width, int height, int stride, int margin,
+		  const struct blur_kernel *kernel)
+{
+	uint8_t *dst;
+	uint32_t *s, *d;
+	int i, j;
+
+	dst = malloc(height * stride);
+	if (dst == NULL)
+		return -1;
+
+	for (i = 0; i < height; i++) {
+		s = (uint32_t *) (src + i * stride);
+		d = (uint32_t *) (dst + i * stride);
+		for (j = 0; j < width; j++) {
+			if (is_copied_column(j, width, margin))
+				d[j] = s[j];
+			else
+				d[j] = blur_pixel_horizontal(s, width, j, kernel);
+		}
+	}
+
+	for (i = 0; i < height; i++) {
+		s = (uint32_t *) (dst + i * stride);
+		d = (uint32_t *) (src + i * stride);
+		for (j = 0; j < width; j++) {
+			if (is_copied_row(i, height, margin))
+				d[j] = s[j];
+			else
+				d[j] = blur_pixel_vertical(dst, height, stride,
+							   i, j, kernel);
+		}
+	}
+
+	free(dst);
+
+	return 0;
+}
+
+#ifdef HAVE_BLUR_X86
+
+/*
+ * The SIMD paths produce the same output as the scalar one: the products
+ * and sums are exact in 32 bit, taps outside of the image read zeroes
+ * instead of being skipped, and the final division is done in double
+ * precision, which truncates to the same integer as the scalar division
+ * for these magnitudes.
+ *
+ * Taps are consumed in pairs. Interleaving the bytes of the pixels for tap
+ * k and k + 1 lets a single pmaddwd multiply all four channels by both
+ * weights and sum them into one 32 bit lane per channel.
+ */
+
+/* Scratch memory shared by the SIMD paths. */
+struct blur_scratch {
+	uint8_t *dst;
+	/* One row with 'half' zero pixels of padding on both sides, plus
+	 * room for reading a full vector past the last tap. */
+	uint32_t *row;
+	/* A row of zeroes, standing in for rows outside of the image. */
+	uint32_t *zero_row;
+};
+
+static bool
+blur_scratch_init(struct blur_scratch *scratch,
+		  int width, int height, int stride,
+		  const struct blur_kernel *kernel)
+{
+	scratch->dst = malloc(height * stride);
+	scratch->row = calloc(width + 2 * kernel->half + 4, sizeof(uint32_t));
+	scratch->zero_row = calloc(width + 4, sizeof(uint32_t));
+
+	if (!scratch->dst || !scratch->row || !scratch->zero_row) {
+		free(scratch->dst);
+		free(scratch->row);
+		free(scratch->zero_row);
+		return false;
+	}
+
+	return true;
+}
+
+static void
+blur_scratch_release(struct blur_scratch *scratch)
+{
+	free(scratch->dst);
+	free(scratch->row);
+	free(scratch->zero_row);
+}
+
+static void
+get_tap_rows(const uint8_t *src, int height, int stride, int i,
+	     const struct blur_kernel *kernel,
+	     const uint32_t *zero_row,
+	     const uint32_t *rows[BLUR_KERNEL_SIZE + 1])
+{
+	int k, r;
+
+	for (k = 0; k < kernel->size + 1; k++) {
+		r = i - kernel->half + k;
+		if (k < kernel->size && r >= 0 && r < height)
+			rows[k] = (const uint32_t *) (src + r * stride);
+		else
+			rows[k] = zero_row;
+	}
+}
+
+__attribute__((target("sse2")))
+static inline __m128i
+divide_sse2(__m128i acc, __m128d sum)
+{
+	__m128d lo, hi;
+
+	lo = _mm_div_pd(_mm_cvtepi32_pd(acc), sum);
+	hi = _mm_div_pd(_mm_cvtepi32_pd(_mm_srli_si128(acc, 8)), sum);
+
+	return _mm_unpacklo_epi64(_mm_cvttpd_epi32(lo), _mm_cvttpd_epi32(hi));
+}
+
+/* Blurs pixels j and j + 1 of a padded row. */
+__attribute__((target("sse2")))
+static inline __m128i
+blur_pair_horizontal_sse2(const uint32_t *row, int j,
+			  const struct blur_kernel *kernel, __m128d sum)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i acc0 = zero, acc1 = zero;
+	__m128i v, pairs, w;
+	int k;
+
+	for (k = 0; k < kernel->size; k += 2) {
+		/* Pixels k .. k + 3 relative to pixel j. */
+		v = _mm_loadu_si128((const __m128i *) (row + j + k));
+		pairs = _mm_unpacklo_epi8(v, _mm_srli_si128(v, 4));
+		w = _mm_set1_epi32(kernel->pairs[k / 2]);
+
+		acc0 = _mm_add_epi32(acc0,
+				     _mm_madd_epi16(_mm_unpacklo_epi8(pairs, zero),
+						    w));
+		acc1 = _mm_add_epi32(acc1,
+				     _mm_madd_epi16(_mm_unpackhi_epi8(pairs, zero),
+						    w));
+	}
+
+	v = _mm_packs_epi32(divide_sse2(acc0, sum), divide_sse2(acc1, sum));
+	return _mm_packus_epi16(v, v);
+}
+
+/* Blurs pixels j .. j + 3 of the row described by rows. */
+__attribute__((target("sse2")))
+static inline __m128i
+blur_quad_vertical_sse2(const uint32_t *rows[], int j,
+			const struct blur_kernel *kernel, __m128d sum)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i acc0 = zero, acc1 = zero, acc2 = zero, acc3 = zero;
+	__m128i a, b, lo, hi, w;
+	int k;
+
+	for (k = 0; k < kernel->size; k += 2) {
+		a = _mm_loadu_si128((const __m128i *) (rows[k] + j));
+		b = _mm_loadu_si128((const __m128i *) (rows[k + 1] + j));
+		lo = _mm_unpacklo_epi8(a, b);
+		hi = _mm_unpackhi_epi8(a, b);
+		w = _mm_set1_epi32(kernel->pairs[k / 2]);
+
+		acc0 = _mm_add_epi32(acc0,
+				     _mm_madd_epi16(_mm_unpacklo_epi8(lo, zero), w));
+		acc1 = _mm_add_epi32(acc1,
+				     _mm_madd_epi16(_mm_unpackhi_epi8(lo, zero), w));
+		acc2 = _mm_add_epi32(acc2,
+				     _mm_madd_epi16(_mm_unpacklo_epi8(hi, zero), w));
+		acc3 = _mm_add_epi32(acc3,
+				     _mm_madd_epi16(_mm_unpackhi_epi8(hi, zero), w));
+	}
+
+	return _mm_packus_epi16(_mm_packs_epi32(divide_sse2(acc0, sum),
+						divide_sse2(acc1, sum)),
+				_mm_packs_epi32(divide_sse2(acc2, sum),
+						divide_sse2(acc3, sum)));
+}
+
+__attribute__((target("sse2")))
+static int
+blur_image_sse2(uint8_t *src, int width, int height, int stride, int margin,
+		const struct blur_kernel *kernel)
+{
+	struct blur_scratch scratch;
+	const uint32_t *rows[BLUR_KERNEL_SIZE + 1];
+	__m128d sum = _mm_set1_pd(kernel->sum);
+	uint32_t *s, *d;
+	__m128i v;
+	int i, j;
+
+	if (!blur_scratch_init(&scratch, width, height, stride, kernel))
+		return -1;
+
+	for (i = 0; i < height; i++) {
+		s = (uint32_t *) (src + i * stride);
+		d = (uint32_t *) (scratch.dst + i * stride);
+		memcpy(scratch.row + kernel->half, s, width * sizeof(uint32_t));
+		for (j = 0; j < width; j++) {
+			if (is_copied_column(j, width, margin)) {
+				d[j] = s[j];
+				continue;
+			}
+
+			v = blur_pair_horizontal_sse2(scratch.row, j,
+						      kernel, sum);
+			if (j + 1 < width &&
+			    !is_copied_column(j + 1, width, margin)) {
+				_mm_storel_epi64((__m128i *) (d + j), v);
+				j++;
+			} else {
+				d[j] = _mm_cvtsi128_si32(v);
+			}
+		}
+	}
+
+	for (i = 0; i < height; i++) {
+		s = (uint32_t *) (scratch.dst + i * stride);
+		d = (uint32_t *) (src + i * stride);
+		if (is_copied_row(i, height, margin)) {
+			memcpy(d, s, width * sizeof(uint32_t));
+			continue;
+		}
+
+		get_tap_rows(scratch.dst, height, stride, i, kernel,
+			     scratch.zero_row, rows);
+		for (j = 0; j + 4 <= width; j += 4) {
+			v = blur_quad_vertical_sse2(rows, j, kernel, sum);
+			_mm_storeu_si128((__m128i *) (d + j), v);
+		}
+		for (; j < width; j++)
+			d[j] = blur_pixel_vertical(scratch.dst, height, stride,
+						   i, j, kernel);
+	}
+
+	blur_scratch_release(&scratch);
+
+	return 0;
+}
+
+__attribute__((target("avx2")))
+static inline __m128i
+divide_avx2(__m128i acc, __m256d sum)
+{
+	return _mm256_cvttpd_epi32(_mm256_div_pd(_mm256_cvtepi32_pd(acc), sum));
+}
+
+/* Blurs pixels j and j + 1 of a padded row. */
+__attribute__((target("avx2")))
+static inline __m128i
+blur_pair_horizontal_avx2(const uint32_t *row, int j,
+			  const struct blur_kernel *kernel, __m256d sum)
+{
+	__m256i acc = _mm256_setzero_si256();
+	__m128i v, pairs;
+	int k;
+
+	for (k = 0; k < kernel->size; k += 2) {
+		v = _mm_loadu_si128((const __m128i *) (row + j + k));
+		pairs = _mm_unpacklo_epi8(v, _mm_srli_si128(v, 4));
+		acc = _mm256_add_epi32(acc,
+				       _mm256_madd_epi16(_mm256_cvtepu8_epi16(pairs),
+							 _mm256_set1_epi32(kernel->pairs[k / 2])));
+	}
+
+	v = _mm_packs_epi32(divide_avx2(_mm256_castsi256_si128(acc), sum),
+			    divide_avx2(_mm256_extracti128_si256(acc, 1), sum));
+	return _mm_packus_epi16(v, v);
+}
+
+/* Blurs pixels j .. j + 3 of the row described by rows. */
+__attribute__((target("avx2")))
+static inline __m128i
+blur_quad_vertical_avx2(const uint32_t *rows[], int j,
+			const struct blur_kernel *kernel, __m256d sum)
+{
+	__m256i acc01 = _mm256_setzero_si256();
+	__m256i acc23 = _mm256_setzero_si256();
+	__m256i w;
+	__m128i a, b;
+	int k;
+
+	for (k = 0; k < kernel->size; k += 2) {
+		a = _mm_loadu_si128((const __m128i *) (rows[k] + j));
+		b = _mm_loadu_si128((const __m128i *) (rows[k + 1] + j));
+		w = _mm256_set1_epi32(kernel->pairs[k / 2]);
+
+		acc01 = _mm256_add_epi32(acc01,
+					 _mm256_madd_epi16(_mm256_cvtepu8_epi16(_mm_unpacklo_epi8(a, b)),
+							   w));
+		acc23 = _mm256_add_epi32(acc23,
+					 _mm256_madd_epi16(_mm256_cvtepu8_epi16(_mm_unpackhi_epi8(a, b)),
+							   w));
+	}
+
+	return _mm_packus_epi16(
+		_mm_packs_epi32(divide_avx2(_mm256_castsi256_si128(acc01), sum),
+				divide_avx2(_mm256_extracti128_si256(acc01, 1), sum)),
+		_mm_packs_epi32(divide_avx2(_mm256_castsi256_si128(acc23), sum),
+				divide_avx2(_mm256_extracti128_si256(acc23, 1), sum)));
+}
+
+__attribute__((target("avx2")))
+static int
+blur_image_avx2(uint8_t *src, int width, int height, int stride, int margin,
+		const struct blur_kernel *kernel)
+{
+	struct blur_scratch scratch;
+	const uint32_t *rows[BLUR_KERNEL_SIZE + 1];
+	__m256d sum = _mm256_set1_pd(kernel->sum);
+	uint32_t *s, *d;
+	__m128i v;
+	int i, j;
+
+	if (!blur_scratch_init(&scratch, width, height, stride, kernel))
+		return -1;
+
+	for (i = 0; i < height; i++) {
+		s = (uint32_t *) (src + i * stride);
+		d = (uint32_t *) (scratch.dst + i * stride);
+		memcpy(scratch.row + kernel->half, s, width * sizeof(uint32_t));
+		for (j = 0; j < width; j++) {
+			if (is_copied_column(j, width, margin)) {
+				d[j] = s[j];
+				continue;
+			}
+
+			v = blur_pair_horizontal_avx2(scratch.row, j,
+						      kernel, sum);
+			if (j + 1 < width &&
+			    !is_copied_column(j + 1, width, margin)) {
+				_mm_storel_epi64((__m128i *) (d + j), v);
+				j++;
+			} else {
+				d[j] = _mm_cvtsi128_si32(v);
+			}
+		}
+	}
+
+	for (i = 0; i < height; i++) {
+		s = (uint32_t *) (scratch.dst + i * stride);
+		d = (uint32_t *) (src + i * stride);
+		if (is_copied_row(i, height, margin)) {
+			memcpy(d, s, width * sizeof(uint32_t));
+			continue;
+		}
+
+		get_tap_rows(scratch.dst, height, stride, i, kernel,
+			     scratch.zero_row, rows);
+		for (j = 0; j + 4 <= width; j += 4) {
+			v = blur_quad_vertical_avx2(rows, j, kernel, sum);
+			_mm_storeu_si128((__m128i *) (d + j), v);
+		}
+		for (; j < width; j++)
+			d[j] = blur_pixel_vertical(scratch.dst, height, stride,
+						   i, j, kernel);
+	}
+
+	blur_scratch_release(&scratch);
+
+	return 0;
+}
+
+#endif /* HAVE_BLUR_X86 */
+
+/*
+ * Approximates the Gaussian of the same variance with three successive box
+ * blurs, each a sliding window sum, so the cost per pixel does not depend
+ * on the radius.
+ */
+
+static void
+get_box_sizes(int radius, int boxes[3])
+{
+	double sigma2, ideal;
+	int i, lower, m;
+
+	/* The Gaussian kernel for a radius r is exp(-x^2 / (2r + 1)). */
+	sigma2 = (2 * radius + 1) / 2.0;
+
+	ideal = sqrt(12.0 * sigma2 / 3 + 1);
+	lower = (int) ideal;
+	if (lower % 2 == 0)
+		lower--;
+
+	m = (int) round((12.0 * sigma2 - 3 * lower * lower - 12 * lower - 9) /
+			(-4.0 * lower - 4));
+
+	for (i = 0; i < 3; i++)
+		boxes[i] = i < m ? lower : lower + 2;
+}
+
+static void
+box_blur_line(const uint32_t *in, int pitch, uint32_t *out, int n, int box)
+{
+	uint32_t sum[4] = { 0 }, p;
+	int half = box / 2;
+	int j, c;
+
+	for (j = 0; j <= half && j < n; j++) {
+		p = in[j * pitch];
+		for (c = 0; c < 4; c++)
+			sum[c] += (p >> (8 * c)) & 0xff;
+	}
+
+	for (j = 0; j < n; j++) {
+		out[j] = 0;
+		for (c = 0; c < 4; c++)
+			out[j] |= ((sum[c] + box / 2) / box) << (8 * c);
+
+		if (j + half + 1 < n) {
+			p = in[(j + half + 1) * pitch];
+			for (c = 0; c < 4; c++)
+				sum[c] += (p >> (8 * c)) & 0xff;
+		}
+		if (j - half >= 0) {
+			p = in[(j - half) * pitch];
+			for (c = 0; c < 4; c++)
+				sum[c] -= (p >> (8 * c)) & 0xff;
+		}
+	}
+}
+
+static void
+box_blur_line3(const uint32_t *in, int pitch, uint32_t *out, uint32_t *tmp,
+	       int n, const int boxes[3])
+{
+	box_blur_line(in, pitch, out, n, boxes[0]);
+	box_blur_line(out, 1, tmp, n, boxes[1]);
+	box_blur_line(tmp, 1, out, n, boxes[2]);
+}
+
+static int
+blur_image_box(uint8_t *src, int width, int height, int stride, int margin,
+	       int radius)
+{
+	uint32_t *line, *tmp, *s;
+	int boxes[3];
+	int i, j, n;
+
+	get_box_sizes(radius, boxes);
+
+	n = width > height ? width : height;
+	line = malloc(2 * n * sizeof(uint32_t));
+	if (line == NULL)
+		return -1;
+	tmp = line + n;
+
+	for (i = 0; i < height; i++) {
+		s = (uint32_t *) (src + i * stride);
+		box_blur_line3(s, 1, line, tmp, width, boxes);
+		for (j = 0; j < width; j++) {
+			if (!is_copied_column(j, width, margin))
+				s[j] = line[j];
+		}
+	}
+
+	for (j = 0; j < width; j++) {
+		s = (uint32_t *) src + j;
+		box_blur_line3(s, stride / sizeof(uint32_t), line, tmp,
+			       height, boxes);
+		for (i = 0; i < height; i++) {
+			if (!is_copied_row(i, height, margin))
+				*(uint32_t *) (src + i * stride + j * 4) = line[i];
+		}
+	}
+
+	free(line);
+
+	return 0;
+}
+
+int
+blur_image(uint8_t *src, int width, int height, int stride, int margin,
+	   int radius)
+{
+	struct blur_kernel kernel;
+
+	if (radius > BLUR_MAX_GAUSSIAN_RADIUS)
+		return blur_image_box(src, width, height, stride, margin,
+				      radius);
+
+	init_blur_kernel(&kernel, radius);
+
+#ifdef HAVE_BLUR_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return blur_image_avx2(src, width, height, stride, margin,
+				       &kernel);
+	if (__builtin_cpu_supports("sse2"))
+		return blur_image_sse2(src, width, height, stride, margin,
+				       &kernel);
+#endif
+
+	return blur_image_scalar(src, width, height, stride, margin, &kernel);
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Blur radius of the decoration shadows. */
+#define BLUR_DEFAULT_RADIUS 35
+
+/*
+ * Shadow tile, blurred once and stretched around the window. The default one
+ * is generated at build time by make-shadow-tile.
+ */
+#define SHADOW_TILE_SIZE 128
+#define SHADOW_TILE_BOUNDARY 32
+#define SHADOW_TILE_BLUR_MARGIN 64
+
+int
+blur_image(uint8_t *data, int width, int height, int stride, int margin,
+	   int radius);
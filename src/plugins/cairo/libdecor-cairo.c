@@ -34,6 +34,7 @@
 #include <stdio.h>
 #include <errno.h>
 #include <limits.h>
+#include <pthread.h>
 #include <wayland-cursor.h>
 
 #include "libdecor-plugin.h"
@@ -44,6 +45,13 @@
 #include <pango/pangocairo.h>
 
 #include "libdecor-cairo-blur.h"
+#include "libdecor-cairo-blur-image.h"
+#include "libdecor-cairo-shadow-tile.h"
+
+#include "viewporter-client-protocol.h"
+#ifdef HAS_SINGLE_PIXEL_BUFFER
+#include "single-pixel-buffer-client-protocol.h"
+#endif
 
 static const size_t SHADOW_MARGIN = 24;	/* graspable part of the border */
 static const size_t TITLE_HEIGHT = 24;
@@ -62,6 +70,30 @@ static const uint32_t COL_SYM_INACT = 0xFF909090;
 
 static const uint32_t DOUBLE_CLICK_TIME_MS = 400;
 
+/*
+ * Nine-slice shadow geometry. The shadow only varies within this distance of
+ * the shadow surface edges, i.e. the tile blur margin minus the part of the
+ * tile that render_shadow() places outside of the surface.
+ */
+static const int SHADOW_SLICE_CORNER = 52;
+/* size of the uniform part of the nine-slice image stretched along the edges */
+static const int SHADOW_SLICE_STRETCH = 8;
+
+/*
+ * shm pools start small and grow up to the reserved size, see shm_pool_grow().
+ * Beyond that, further pools are created, so that the address space reserved
+ * stays moderate on 32 bit systems.
+ */
+static const size_t SHM_POOL_INITIAL_SIZE = 1024 * 1024;
+static const size_t SHM_POOL_RESERVED_SIZE = 16 * 1024 * 1024;
+/* buffers start at cache line boundaries */
+static const size_t SHM_RANGE_ALIGNMENT = 64;
+/*
+ * Component buffers are allocated in steps of this many buffer pixels, so
+ * that resizing reuses them until they are too small, or two steps too large.
+ */
+static const int BUFFER_CAPACITY_STEP = 64;
+
 static const char *cursor_names[] = {
 	"top_side",
 	"bottom_side",
@@ -127,6 +159,89 @@ enum composite_mode {
 	COMPOSITE_CLIENT,
 };
 
+enum button_glyph {
+	BUTTON_GLYPH_MIN,
+	BUTTON_GLYPH_MAX,
+	BUTTON_GLYPH_RESTORE,
+	BUTTON_GLYPH_CLOSE,
+	BUTTON_GLYPH_COUNT,
+};
+
+enum button_state {
+	BUTTON_STATE_NORMAL,
+	BUTTON_STATE_PRELIGHT,
+	BUTTON_STATE_DISABLED,
+	BUTTON_STATE_INACTIVE,
+	BUTTON_STATE_INACTIVE_PRELIGHT,
+	BUTTON_STATE_COUNT,
+};
+
+/*
+ * All button glyphs in all states, rendered once per scale. Glyphs are laid
+ * out in rows and states in columns, each cell being BUTTON_WIDTH wide and
+ * TITLE_HEIGHT high.
+ */
+struct button_atlas {
+	int scale;
+	cairo_surface_t *image;
+
+	struct wl_list link;
+};
+
+/*
+ * Blurred shadow tile shared by all frames. The tile does not depend on the
+ * scale, as it is scaled when the shadow is rendered.
+ */
+struct shadow_tile {
+	int size;
+	int boundary;
+	int blur_margin;
+
+	cairo_surface_t *image;
+
+	struct wl_list link;
+};
+
+enum shadow_slice_position {
+	SHADOW_SLICE_TOP_LEFT,
+	SHADOW_SLICE_TOP,
+	SHADOW_SLICE_TOP_RIGHT,
+	SHADOW_SLICE_LEFT,
+	SHADOW_SLICE_RIGHT,
+	SHADOW_SLICE_BOTTOM_LEFT,
+	SHADOW_SLICE_BOTTOM,
+	SHADOW_SLICE_BOTTOM_RIGHT,
+	SHADOW_SLICE_COUNT,
+};
+
+/*
+ * Part of a decoration component shown as a subsurface of the component
+ * surface, cropped or stretched with a viewport. Child surfaces take no input,
+ * so that pointer events go to the component surface.
+ */
+struct child_surface {
+	struct wl_surface *wl_surface;
+	struct wl_subsurface *wl_subsurface;
+	struct wp_viewport *wp_viewport;
+	cairo_rectangle_int_t opaque_region;
+};
+
+/* The shadow of a minimal window, rendered once per scale. */
+struct shadow_slice_buffer {
+	int scale;
+	struct buffer *buffer;
+
+	struct wl_list link;
+};
+
+/* 1x1 buffer of a single color, to be stretched with a viewport. */
+struct solid_buffer {
+	uint32_t color;
+	struct buffer *buffer;
+
+	struct wl_list link;
+};
+
 struct seat {
 	struct libdecor_plugin_cairo *plugin_cairo;
 
@@ -168,11 +283,46 @@ struct output {
 	struct wl_list link;
 };
 
+/* free range of a shm pool */
+struct shm_range {
+	size_t offset;
+	size_t size;
+
+	struct wl_list link;
+};
+
+/*
+ * Shared memory file, mapped once and shared with the compositor as a single
+ * wl_shm_pool, from which buffers are sub-allocated.
+ */
+struct shm_pool {
+	struct libdecor_plugin_cairo *plugin_cairo;
+	struct wl_shm_pool *wl_shm_pool;
+	int fd;
+	void *data;
+	size_t size;
+	/* address space reserved for the mapping to grow into */
+	size_t max_size;
+
+	/* struct shm_range, sorted by offset */
+	struct wl_list free_list;
+	/* struct buffer::link */
+	struct wl_list buffer_list;
+
+	struct wl_list link;
+};
+
 struct buffer {
 	struct wl_buffer *wl_buffer;
 	bool in_use;
+	/* freed, waiting for the compositor to release it */
 	bool is_detached;
 
+	/* pool and range of the buffer, unless it is a single pixel buffer */
+	struct shm_pool *pool;
+	size_t offset;
+	struct wl_list link;
+
 	void *data;
 	size_t data_size;
 	int width;
@@ -180,6 +330,14 @@ struct buffer {
 	int scale;
 	int buffer_width;
 	int buffer_height;
+	int stride;
+	enum wl_shm_format format;
+	/* buffer size the data can hold, see resize_shm_buffer() */
+	int capacity_width;
+	int capacity_height;
+
+	/* cairo surface for the data, see get_buffer_surface() */
+	cairo_surface_t *surface;
 };
 
 struct border_component {
@@ -192,12 +350,31 @@ struct border_component {
 	struct {
 		struct wl_surface *wl_surface;
 		struct wl_subsurface *wl_subsurface;
+		struct wp_viewport *wp_viewport;
 		struct buffer *buffer;
+		/* rendering for the opposite activation state, if any */
+		struct buffer *alternate_buffer;
+		/*
+		 * buffers owned by the component, including buffer and
+		 * alternate_buffer, reused once released by the compositor
+		 */
+		struct buffer *buffers[3];
+		/* buffer last committed, if still attached */
+		struct buffer *attached_buffer;
+		/* buffer area drawn since attached_buffer was committed */
+		cairo_region_t *damage;
+		/* opaque region last set, see update_opaque_region() */
+		cairo_rectangle_int_t opaque_region;
+		/*
+		 * input region last set, the outer rectangle minus the hole,
+		 * see set_component_input_region()
+		 */
+		cairo_rectangle_int_t input_region;
+		cairo_rectangle_int_t input_region_hole;
 		struct wl_list output_list;
 		int scale;
 	} server;
 	struct {
-		cairo_surface_t *image;
 		struct border_component *parent_component;
 	} client;
 
@@ -235,20 +412,95 @@ struct libdecor_frame_cairo {
 	struct border_component *active;
 	struct border_component *grab;
 
+	/* bitmask of components (1 << enum component) needing a redraw */
+	uint32_t dirty_components;
+
+	/* the scheduled redraw requires committing the main surface */
+	bool needs_toplevel_commit;
+
+	/*
+	 * frame callback on the main surface, pending while committed
+	 * decoration state waits for the application to commit
+	 */
+	struct wl_callback *pending_commit_callback;
+
+	/*
+	 * frame callback for the last scheduled redraw, further redraws wait
+	 * until it is done
+	 */
+	struct wl_callback *redraw_callback;
+	struct wl_surface *redraw_callback_surface;
+	bool wants_redraw_callback;
+
 	bool shadow_showing;
 	struct border_component shadow;
 
+	/* corners and edges of the shadow, see draw_shadow_slices() */
+	struct child_surface shadow_slices[SHADOW_SLICE_COUNT];
+	/* scale of the nine-slice image attached to the slices, or 0 */
+	int shadow_slices_scale;
+
 	struct {
 		bool is_showing;
 		struct border_component title;
 		struct border_component min;
 		struct border_component max;
 		struct border_component close;
+
+		/*
+		 * bitmask of components (1 << enum component) drawn since the
+		 * alternate title bar buffer was last up to date
+		 */
+		uint32_t alternate_dirty;
+
+		/*
+		 * With viewports, the title surface shows a stretched solid
+		 * background, below fixed size parts for the title text and
+		 * for the fade-out and buttons at the right end, so that
+		 * resizing only moves the parts. See draw_title_bar_parts().
+		 */
+		struct child_surface text;
+		struct buffer *text_buffer;
+		bool is_text_showing;
+		struct child_surface cluster;
+		struct buffer *cluster_buffer;
+		struct buffer *cluster_buffers[2];
+		uint32_t cluster_key;
 	} title_bar;
 
-	/* store pre-processed shadow tile */
+	/* shaped title text, invalidated when the title or scale changes */
+	struct {
+		PangoLayout *layout;
+		int scale;
+		int text_width;
+		int text_height;
+		PangoRectangle ink_rect;
+
+		/* rasterized title text for the inactive and active state */
+		cairo_surface_t *images[2];
+		struct buffer *buffers[2];
+	} title_layout;
+
+	/* reference to the pre-processed shadow tile shared by all frames */
 	cairo_surface_t *shadow_blur;
 
+	/*
+	 * component rectangles and shadow resize edges for the content size
+	 * they were computed for, see ensure_layout()
+	 */
+	struct {
+		bool is_valid;
+		int content_width;
+		int content_height;
+		cairo_rectangle_int_t components[BUTTON_CLOSE + 1];
+
+		/* the pointer is on a resize edge outside these shadow coords */
+		int edge_left;
+		int edge_right;
+		int edge_top;
+		int edge_bottom;
+	} layout;
+
 	struct wl_list link;
 };
 
@@ -258,6 +510,12 @@ struct libdecor_plugin_cairo {
 	struct wl_callback *globals_callback;
 	struct wl_callback *globals_callback_shm;
 
+	/*
+	 * sync callback flushing scheduled redraws, for applications
+	 * dispatching the display themselves
+	 */
+	struct wl_callback *flush_callback;
+
 	struct libdecor *context;
 
 	struct wl_registry *wl_registry;
@@ -268,6 +526,9 @@ struct libdecor_plugin_cairo {
 	struct wl_callback *shm_callback;
 	bool has_argb;
 
+	struct wp_viewporter *wp_viewporter;
+	struct wp_single_pixel_buffer_manager_v1 *wp_single_pixel_buffer_manager;
+
 	struct wl_list visible_frame_list;
 	struct wl_list seat_list;
 	struct wl_list output_list;
@@ -276,6 +537,21 @@ struct libdecor_plugin_cairo {
 	int cursor_size;
 
 	PangoFontDescription *font;
+
+	/*
+	 * Font map warmed up on a background thread once the first frame is
+	 * created, only to be used after the thread has been joined.
+	 */
+	PangoFontMap *font_map;
+	pthread_t font_thread;
+	bool font_thread_running;
+
+	struct wl_list button_atlas_list;
+	struct wl_list shadow_tile_list;
+	struct wl_list shadow_slice_buffer_list;
+	struct wl_list solid_buffer_list;
+
+	struct wl_list shm_pool_list;
 };
 
 static const char *libdecor_cairo_proxy_tag = "libdecor-cairo";
@@ -335,6 +611,9 @@ closeable(struct libdecor_frame_cairo *frame_cairo) {
 static void
 buffer_free(struct buffer *buffer);
 
+static void
+shm_pool_destroy(struct shm_pool *pool);
+
 static void
 draw_border_component(struct libdecor_frame_cairo *frame_cairo,
 		      struct border_component *border_component);
@@ -342,6 +621,9 @@ draw_border_component(struct libdecor_frame_cairo *frame_cairo,
 static void
 send_cursor(struct seat *seat);
 
+static void
+flush_scheduled_redraws(struct libdecor_plugin_cairo *plugin_cairo);
+
 static bool
 update_local_cursor(struct seat *seat);
 
@@ -353,11 +635,18 @@ libdecor_plugin_cairo_destroy(struct libdecor_plugin *plugin)
 	struct seat *seat, *seat_tmp;
 	struct output *output, *output_tmp;
 	struct libdecor_frame_cairo *frame, *frame_tmp;
+	struct button_atlas *atlas, *atlas_tmp;
+	struct shadow_tile *tile, *tile_tmp;
+	struct shadow_slice_buffer *slice_buffer, *slice_buffer_tmp;
+	struct solid_buffer *solid_buffer, *solid_buffer_tmp;
+	struct shm_pool *pool, *pool_tmp;
 
 	if (plugin_cairo->globals_callback)
 		wl_callback_destroy(plugin_cairo->globals_callback);
 	if (plugin_cairo->globals_callback_shm)
 		wl_callback_destroy(plugin_cairo->globals_callback_shm);
+	if (plugin_cairo->flush_callback)
+		wl_callback_destroy(plugin_cairo->flush_callback);
 	if (plugin_cairo->shm_callback)
 		wl_callback_destroy(plugin_cairo->shm_callback);
 	wl_registry_destroy(plugin_cairo->wl_registry);
@@ -393,12 +682,54 @@ libdecor_plugin_cairo_destroy(struct libdecor_plugin *plugin)
 		wl_list_remove(&frame->link);
 	}
 
+	wl_list_for_each_safe(atlas, atlas_tmp,
+			      &plugin_cairo->button_atlas_list, link) {
+		cairo_surface_destroy(atlas->image);
+		wl_list_remove(&atlas->link);
+		free(atlas);
+	}
+
+	wl_list_for_each_safe(tile, tile_tmp,
+			      &plugin_cairo->shadow_tile_list, link) {
+		cairo_surface_destroy(tile->image);
+		wl_list_remove(&tile->link);
+		free(tile);
+	}
+
+	wl_list_for_each_safe(slice_buffer, slice_buffer_tmp,
+			      &plugin_cairo->shadow_slice_buffer_list, link) {
+		buffer_free(slice_buffer->buffer);
+		wl_list_remove(&slice_buffer->link);
+		free(slice_buffer);
+	}
+
+	wl_list_for_each_safe(solid_buffer, solid_buffer_tmp,
+			      &plugin_cairo->solid_buffer_list, link) {
+		buffer_free(solid_buffer->buffer);
+		wl_list_remove(&solid_buffer->link);
+		free(solid_buffer);
+	}
+
+	wl_list_for_each_safe(pool, pool_tmp, &plugin_cairo->shm_pool_list, link)
+		shm_pool_destroy(pool);
+
 	free(plugin_cairo->cursor_theme_name);
 
 	wl_shm_destroy(plugin_cairo->wl_shm);
 
+	if (plugin_cairo->font_thread_running)
+		pthread_join(plugin_cairo->font_thread, NULL);
+	if (plugin_cairo->font_map)
+		g_object_unref(plugin_cairo->font_map);
 	pango_font_description_free(plugin_cairo->font);
 
+	if (plugin_cairo->wp_viewporter)
+		wp_viewporter_destroy(plugin_cairo->wp_viewporter);
+#ifdef HAS_SINGLE_PIXEL_BUFFER
+	if (plugin_cairo->wp_single_pixel_buffer_manager)
+		wp_single_pixel_buffer_manager_v1_destroy(
+			plugin_cairo->wp_single_pixel_buffer_manager);
+#endif
 	wl_compositor_destroy(plugin_cairo->wl_compositor);
 	wl_subcompositor_destroy(plugin_cairo->wl_subcompositor);
 
@@ -445,29 +776,124 @@ init_components(struct libdecor_frame_cairo *frame_cairo)
 			      SHADOW);
 }
 
-static struct libdecor_frame_cairo *
-libdecor_frame_cairo_new(struct libdecor_plugin_cairo *plugin_cairo)
+static PangoFontMap *
+create_font_map(const PangoFontDescription *font)
 {
-	struct libdecor_frame_cairo *frame_cairo = zalloc(sizeof *frame_cairo);
+	PangoFontMap *font_map;
+	PangoContext *context;
+	PangoLayout *layout;
+	int width, height;
+
+	/*
+	 * Shaping some text initializes fontconfig and loads the font used
+	 * for titles, which is the expensive part of drawing the first title.
+	 */
+	font_map = pango_cairo_font_map_new();
+	context = pango_font_map_create_context(font_map);
+	layout = pango_layout_new(context);
+	pango_layout_set_font_description(layout, font);
+	pango_layout_set_text(layout, "libdecor", -1);
+	pango_layout_get_size(layout, &width, &height);
+	g_object_unref(layout);
+	g_object_unref(context);
+
+	return font_map;
+}
+
+static void *
+font_thread_func(void *data)
+{
+	struct libdecor_plugin_cairo *plugin_cairo = data;
+
+	plugin_cairo->font_map = create_font_map(plugin_cairo->font);
+
+	return NULL;
+}
+
+static void
+start_font_warmup(struct libdecor_plugin_cairo *plugin_cairo)
+{
+	if (plugin_cairo->font_map || plugin_cairo->font_thread_running)
+		return;
+
+	if (pthread_create(&plugin_cairo->font_thread, NULL,
+			   font_thread_func, plugin_cairo) == 0)
+		plugin_cairo->font_thread_running = true;
+}
+
+static PangoFontMap *
+get_font_map(struct libdecor_plugin_cairo *plugin_cairo)
+{
+	if (plugin_cairo->font_thread_running) {
+		pthread_join(plugin_cairo->font_thread, NULL);
+		plugin_cairo->font_thread_running = false;
+	}
+
+	/* warm-up not started or failed to start, initialize synchronously */
+	if (!plugin_cairo->font_map)
+		plugin_cairo->font_map = create_font_map(plugin_cairo->font);
+
+	return plugin_cairo->font_map;
+}
+
+static cairo_surface_t *
+get_shadow_tile(struct libdecor_plugin_cairo *plugin_cairo,
+		int size,
+		int boundary,
+		int blur_margin)
+{
+	struct shadow_tile *tile;
 	cairo_t *cr;
 
-	static const int size = 128;
-	static const int boundary = 32;
+	wl_list_for_each(tile, &plugin_cairo->shadow_tile_list, link) {
+		if (tile->size == size &&
+		    tile->boundary == boundary &&
+		    tile->blur_margin == blur_margin)
+			return tile->image;
+	}
 
-	frame_cairo->plugin_cairo = plugin_cairo;
-	frame_cairo->shadow_blur = cairo_image_surface_create(
-					CAIRO_FORMAT_ARGB32, size, size);
-	wl_list_insert(&plugin_cairo->visible_frame_list, &frame_cairo->link);
+	tile = zalloc(sizeof *tile);
+	tile->size = size;
+	tile->boundary = boundary;
+	tile->blur_margin = blur_margin;
+	wl_list_insert(&plugin_cairo->shadow_tile_list, &tile->link);
+
+	/* The default tile is generated at build time; it is only ever used
+	 * as a mask source, so cairo never writes to the read-only data. */
+	if (size == SHADOW_TILE_SIZE &&
+	    boundary == SHADOW_TILE_BOUNDARY &&
+	    blur_margin == SHADOW_TILE_BLUR_MARGIN) {
+		tile->image = cairo_image_surface_create_for_data(
+			(unsigned char *) shadow_tile_builtin_data,
+			CAIRO_FORMAT_ARGB32,
+			size, size,
+			size * sizeof shadow_tile_builtin_data[0]);
+		return tile->image;
+	}
 
-	init_components(frame_cairo);
+	tile->image = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+						 size, size);
 
-	cr = cairo_create(frame_cairo->shadow_blur);
+	cr = cairo_create(tile->image);
 	cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
 	cairo_set_source_rgba(cr, 0, 0, 0, 1);
 	cairo_rectangle(cr, boundary, boundary, size-2*boundary, size-2*boundary);
 	cairo_fill(cr);
 	cairo_destroy(cr);
-	blur_surface(frame_cairo->shadow_blur, 64);
+	blur_surface(tile->image, blur_margin);
+
+	return tile->image;
+}
+
+static struct libdecor_frame_cairo *
+libdecor_frame_cairo_new(struct libdecor_plugin_cairo *plugin_cairo)
+{
+	struct libdecor_frame_cairo *frame_cairo = zalloc(sizeof *frame_cairo);
+
+	frame_cairo->plugin_cairo = plugin_cairo;
+	wl_list_insert(&plugin_cairo->visible_frame_list, &frame_cairo->link);
+
+	init_components(frame_cairo);
 
 	return frame_cairo;
 }
@@ -498,6 +924,9 @@ libdecor_plugin_cairo_dispatch(struct libdecor_plugin *plugin,
 	while (wl_display_prepare_read(wl_display) != 0)
 		dispatch_count += wl_display_dispatch_pending(wl_display);
 
+	/* draw what was scheduled since the last dispatch */
+	flush_scheduled_redraws(plugin_cairo);
+
 	if (wl_display_flush(wl_display) < 0 &&
 	    errno != EAGAIN) {
 		wl_display_cancel_read(wl_display);
@@ -511,6 +940,8 @@ libdecor_plugin_cairo_dispatch(struct libdecor_plugin *plugin,
 		if (fds[0].revents & POLLIN) {
 			wl_display_read_events(wl_display);
 			dispatch_count += wl_display_dispatch_pending(wl_display);
+			flush_scheduled_redraws(plugin_cairo);
+			wl_display_flush(wl_display);
 			return dispatch_count;
 		} else {
 			wl_display_cancel_read(wl_display);
@@ -534,6 +965,9 @@ libdecor_plugin_cairo_frame_new(struct libdecor_plugin *plugin)
 
 	frame_cairo = libdecor_frame_cairo_new(plugin_cairo);
 
+	/* have fonts ready by the time the first title is drawn */
+	start_font_warmup(plugin_cairo);
+
 	return &frame_cairo->frame;
 }
 
@@ -582,983 +1016,2736 @@ buffer_release(void *user_data,
 {
 	struct buffer *buffer = user_data;
 
+	buffer->in_use = false;
 	if (buffer->is_detached)
 		buffer_free(buffer);
-	else
-		buffer->in_use = false;
 }
 
 static const struct wl_buffer_listener buffer_listener = {
 	buffer_release
 };
 
-static struct buffer *
-create_shm_buffer(struct libdecor_plugin_cairo *plugin_cairo,
-		  int width,
-		  int height,
-		  bool opaque,
-		  int scale)
+static size_t
+round_up_to_page_size(size_t size)
 {
-	struct wl_shm_pool *pool;
-	int fd, size, buffer_width, buffer_height, stride;
-	void *data;
-	struct buffer *buffer;
-	enum wl_shm_format buf_fmt;
-
-	buffer_width = width * scale;
-	buffer_height = height * scale;
-	stride = buffer_width * 4;
-	size = stride * buffer_height;
+	size_t page_size = sysconf(_SC_PAGESIZE);
 
-	fd = create_anonymous_file(size);
-	if (fd < 0) {
-		fprintf(stderr, "creating a buffer file for %d B failed: %s\n",
-			size, strerror(errno));
-		return NULL;
-	}
-
-	data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-	if (data == MAP_FAILED) {
-		fprintf(stderr, "mmap failed: %s\n", strerror(errno));
-		close(fd);
-		return NULL;
-	}
-
-	buf_fmt = opaque ? WL_SHM_FORMAT_XRGB8888 : WL_SHM_FORMAT_ARGB8888;
-
-	pool = wl_shm_create_pool(plugin_cairo->wl_shm, fd, size);
-	buffer = zalloc(sizeof *buffer);
-	buffer->wl_buffer = wl_shm_pool_create_buffer(pool, 0,
-						      buffer_width, buffer_height,
-						      stride,
-						      buf_fmt);
-	wl_buffer_add_listener(buffer->wl_buffer, &buffer_listener, buffer);
-	wl_shm_pool_destroy(pool);
-	close(fd);
-
-	buffer->data = data;
-	buffer->data_size = size;
-	buffer->width = width;
-	buffer->height = height;
-	buffer->scale = scale;
-	buffer->buffer_width = buffer_width;
-	buffer->buffer_height = buffer_height;
-
-	return buffer;
+	return (size + page_size - 1) / page_size * page_size;
 }
 
 static void
-buffer_free(struct buffer *buffer)
+shm_pool_destroy(struct shm_pool *pool)
 {
-	if (buffer->wl_buffer) {
+	struct buffer *buffer, *buffer_tmp;
+	struct shm_range *range, *range_tmp;
+
+	/* buffers still waiting for the compositor to release them */
+	wl_list_for_each_safe(buffer, buffer_tmp, &pool->buffer_list, link) {
 		wl_buffer_destroy(buffer->wl_buffer);
-		munmap(buffer->data, buffer->data_size);
-		buffer->wl_buffer = NULL;
-		buffer->in_use = false;
+		if (buffer->surface)
+			cairo_surface_destroy(buffer->surface);
+		wl_list_remove(&buffer->link);
+		free(buffer);
 	}
-	free(buffer);
-}
 
-static void
-free_border_component(struct border_component *border_component)
-{
-	struct surface_output *surface_output, *surface_output_tmp;
-
-	if (border_component->server.wl_surface) {
-		wl_subsurface_destroy(border_component->server.wl_subsurface);
-		border_component->server.wl_subsurface = NULL;
-		wl_surface_destroy(border_component->server.wl_surface);
-		border_component->server.wl_surface = NULL;
-	}
-	if (border_component->server.buffer) {
-		buffer_free(border_component->server.buffer);
-		border_component->server.buffer = NULL;
-	}
-	if (border_component->client.image) {
-		cairo_surface_destroy(border_component->client.image);
-		border_component->client.image = NULL;
-	}
-	if (border_component->server.output_list.next != NULL) {
-		wl_list_for_each_safe(surface_output, surface_output_tmp,
-				      &border_component->server.output_list, link) {
-			wl_list_remove(&surface_output->link);
-			free(surface_output);
-		}
+	wl_list_for_each_safe(range, range_tmp, &pool->free_list, link) {
+		wl_list_remove(&range->link);
+		free(range);
 	}
+
+	wl_shm_pool_destroy(pool->wl_shm_pool);
+	munmap(pool->data, pool->max_size);
+	close(pool->fd);
+	wl_list_remove(&pool->link);
+	free(pool);
 }
 
-static void
-libdecor_plugin_cairo_frame_free(struct libdecor_plugin *plugin,
-				 struct libdecor_frame *frame)
+/*
+ * Return a range to the free list, which is sorted by offset, merging it
+ * with adjacent free ranges. Returns the free range now containing it.
+ */
+static struct shm_range *
+shm_pool_free_range(struct shm_pool *pool, size_t offset, size_t size)
 {
-	struct libdecor_plugin_cairo *plugin_cairo =
-		(struct libdecor_plugin_cairo *) plugin;
-	struct libdecor_frame_cairo *frame_cairo =
-		(struct libdecor_frame_cairo *) frame;
-	struct seat *seat;
+	struct shm_range *range, *next = NULL, *prev = NULL;
 
-	wl_list_for_each(seat, &plugin_cairo->seat_list, link) {
-		if (seat->pointer_focus != NULL &&
-		    wl_surface_get_user_data(seat->pointer_focus) == frame_cairo)
-			seat->pointer_focus = NULL;
+	wl_list_for_each(range, &pool->free_list, link) {
+		if (range->offset > offset) {
+			next = range;
+			break;
+		}
+		prev = range;
 	}
 
-	free_border_component(&frame_cairo->title_bar.title);
-	free_border_component(&frame_cairo->title_bar.min);
-	free_border_component(&frame_cairo->title_bar.max);
-	free_border_component(&frame_cairo->title_bar.close);
-	frame_cairo->title_bar.is_showing = false;
-	free_border_component(&frame_cairo->shadow);
-	frame_cairo->shadow_showing = false;
-	if (frame_cairo->shadow_blur != NULL) {
-		cairo_surface_destroy(frame_cairo->shadow_blur);
-		frame_cairo->shadow_blur = NULL;
+	if (prev && prev->offset + prev->size == offset) {
+		prev->size += size;
+		if (next && prev->offset + prev->size == next->offset) {
+			prev->size += next->size;
+			wl_list_remove(&next->link);
+			free(next);
+		}
+		return prev;
 	}
 
-	free(frame_cairo->title);
-	frame_cairo->title = NULL;
+	if (next && offset + size == next->offset) {
+		next->offset = offset;
+		next->size += size;
+		return next;
+	}
 
-	frame_cairo->decoration_type = DECORATION_TYPE_NONE;
+	range = zalloc(sizeof *range);
+	range->offset = offset;
+	range->size = size;
+	wl_list_insert(prev ? &prev->link : &pool->free_list, &range->link);
 
-	if (frame_cairo->link.next != NULL)
-		wl_list_remove(&frame_cairo->link);
+	return range;
 }
 
-static bool
-is_border_surfaces_showing(struct libdecor_frame_cairo *frame_cairo)
+/*
+ * Give the pages within a free range back to the system. They stay part of
+ * the pool, and are allocated again once written to.
+ */
+static void
+shm_pool_discard_range(struct shm_pool *pool, struct shm_range *range)
 {
-	return frame_cairo->shadow_showing;
+#ifdef FALLOC_FL_PUNCH_HOLE
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	size_t start = round_up_to_page_size(range->offset);
+	size_t end = (range->offset + range->size) / page_size * page_size;
+
+	if (end > start)
+		fallocate(pool->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+			  start, end - start);
+#endif
 }
 
 static bool
-is_title_bar_surfaces_showing(struct libdecor_frame_cairo *frame_cairo)
+shm_pool_alloc_range(struct shm_pool *pool, size_t size, size_t *offset)
 {
-	return frame_cairo->title_bar.is_showing;
-}
-
+	struct shm_range *range;
+
+	wl_list_for_each(range, &pool->free_list, link) {
+		if (range->size < size)
+			continue;
+
+		*offset = range->offset;
+		range->offset += size;
+		range->size -= size;
+		if (range->size == 0) {
+			wl_list_remove(&range->link);
+			free(range);
+		}
+		return true;
+	}
+
+	return false;
+}
+
+/*
+ * Grow the pool to have at least the given size free at its end. The file is
+ * mapped into address space reserved up front, so existing buffers keep their
+ * addresses.
+ */
+static bool
+shm_pool_grow(struct shm_pool *pool, size_t size)
+{
+	struct shm_range *last;
+	size_t tail = 0;
+	size_t new_size;
+	void *data;
+	int ret;
+
+	if (!wl_list_empty(&pool->free_list)) {
+		last = wl_container_of(pool->free_list.prev, last, link);
+		if (last->offset + last->size == pool->size)
+			tail = last->size;
+	}
+
+	new_size = round_up_to_page_size(pool->size - tail + size);
+	new_size = MAX(new_size, MIN(2 * pool->size, pool->max_size));
+	if (new_size > pool->max_size)
+		return false;
+
+	do {
+		ret = posix_fallocate(pool->fd, pool->size,
+				      new_size - pool->size);
+	} while (ret == EINTR);
+	if (ret != 0) {
+		fprintf(stderr, "growing a buffer file to %zu B failed: %s\n",
+			new_size, strerror(ret));
+		return false;
+	}
+
+	data = mmap((char *) pool->data + pool->size, new_size - pool->size,
+		    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+		    pool->fd, pool->size);
+	if (data == MAP_FAILED) {
+		fprintf(stderr, "mmap failed: %s\n", strerror(errno));
+		return false;
+	}
+
+	wl_shm_pool_resize(pool->wl_shm_pool, new_size);
+	shm_pool_free_range(pool, pool->size, new_size - pool->size);
+	pool->size = new_size;
+
+	return true;
+}
+
+static struct shm_pool *
+shm_pool_create(struct libdecor_plugin_cairo *plugin_cairo, size_t min_size)
+{
+	struct shm_pool *pool;
+	size_t size, max_size;
+	void *data;
+	int fd;
+
+	min_size = round_up_to_page_size(min_size);
+	size = MAX(SHM_POOL_INITIAL_SIZE, min_size);
+	max_size = MAX(SHM_POOL_RESERVED_SIZE, min_size);
+	if (max_size > INT32_MAX) {
+		fprintf(stderr, "buffer of %zu B too large\n", min_size);
+		return NULL;
+	}
+
+	fd = create_anonymous_file(size);
+	if (fd < 0) {
+		fprintf(stderr, "creating a buffer file for %zu B failed: %s\n",
+			size, strerror(errno));
+		return NULL;
+	}
+
+	/* reserve the address space to grow into */
+	data = mmap(NULL, max_size, PROT_NONE,
+		    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (data == MAP_FAILED ||
+	    mmap(data, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+		 fd, 0) == MAP_FAILED) {
+		fprintf(stderr, "mmap failed: %s\n", strerror(errno));
+		if (data != MAP_FAILED)
+			munmap(data, max_size);
+		close(fd);
+		return NULL;
+	}
+
+	pool = zalloc(sizeof *pool);
+	pool->plugin_cairo = plugin_cairo;
+	pool->fd = fd;
+	pool->data = data;
+	pool->size = size;
+	pool->max_size = max_size;
+	pool->wl_shm_pool = wl_shm_create_pool(plugin_cairo->wl_shm, fd, size);
+	wl_list_init(&pool->free_list);
+	wl_list_init(&pool->buffer_list);
+	wl_list_insert(plugin_cairo->shm_pool_list.prev, &pool->link);
+
+	shm_pool_free_range(pool, 0, size);
+
+	return pool;
+}
+
+/*
+ * Allocate a range for a buffer from the plugin wide shm pools. Pools first
+ * grow in place, before another pool is created.
+ */
+static struct shm_pool *
+alloc_shm_range(struct libdecor_plugin_cairo *plugin_cairo,
+		size_t size,
+		size_t *offset)
+{
+	struct shm_pool *pool;
+
+	wl_list_for_each(pool, &plugin_cairo->shm_pool_list, link) {
+		if (shm_pool_alloc_range(pool, size, offset))
+			return pool;
+	}
+
+	wl_list_for_each(pool, &plugin_cairo->shm_pool_list, link) {
+		if (shm_pool_grow(pool, size) &&
+		    shm_pool_alloc_range(pool, size, offset))
+			return pool;
+	}
+
+	pool = shm_pool_create(plugin_cairo, size);
+	if (!pool || !shm_pool_alloc_range(pool, size, offset))
+		return NULL;
+
+	return pool;
+}
+
+static struct buffer *
+create_shm_buffer_with_capacity(struct libdecor_plugin_cairo *plugin_cairo,
+				int width,
+				int height,
+				bool opaque,
+				int scale,
+				int capacity_width,
+				int capacity_height)
+{
+	struct shm_pool *pool;
+	size_t size, offset;
+	int buffer_width, buffer_height, stride;
+	struct buffer *buffer;
+	enum wl_shm_format buf_fmt;
+
+	buffer_width = width * scale;
+	buffer_height = height * scale;
+	stride = capacity_width * 4;
+	size = (size_t) stride * capacity_height;
+	size = (size + SHM_RANGE_ALIGNMENT - 1) &
+	       ~(size_t) (SHM_RANGE_ALIGNMENT - 1);
+
+	pool = alloc_shm_range(plugin_cairo, size, &offset);
+	if (!pool)
+		return NULL;
+
+	buf_fmt = opaque ? WL_SHM_FORMAT_XRGB8888 : WL_SHM_FORMAT_ARGB8888;
+
+	buffer = zalloc(sizeof *buffer);
+	buffer->wl_buffer = wl_shm_pool_create_buffer(pool->wl_shm_pool,
+						      offset,
+						      buffer_width, buffer_height,
+						      stride,
+						      buf_fmt);
+	wl_buffer_add_listener(buffer->wl_buffer, &buffer_listener, buffer);
+
+	buffer->pool = pool;
+	buffer->offset = offset;
+	wl_list_insert(&pool->buffer_list, &buffer->link);
+
+	buffer->data = (char *) pool->data + offset;
+	buffer->data_size = size;
+	buffer->width = width;
+	buffer->height = height;
+	buffer->scale = scale;
+	buffer->buffer_width = buffer_width;
+	buffer->buffer_height = buffer_height;
+	buffer->stride = stride;
+	buffer->format = buf_fmt;
+	buffer->capacity_width = capacity_width;
+	buffer->capacity_height = capacity_height;
+
+	return buffer;
+}
+
+static struct buffer *
+create_shm_buffer(struct libdecor_plugin_cairo *plugin_cairo,
+		  int width,
+		  int height,
+		  bool opaque,
+		  int scale)
+{
+	return create_shm_buffer_with_capacity(plugin_cairo,
+					       width, height, opaque, scale,
+					       width * scale, height * scale);
+}
+
+static int
+get_buffer_capacity(int size)
+{
+	return (size + BUFFER_CAPACITY_STEP - 1) /
+	       BUFFER_CAPACITY_STEP * BUFFER_CAPACITY_STEP;
+}
+
+static bool
+is_buffer_capacity_suitable(struct buffer *buffer,
+			    int buffer_width,
+			    int buffer_height)
+{
+	const int slack = 2 * BUFFER_CAPACITY_STEP;
+
+	return (buffer_width <= buffer->capacity_width &&
+		buffer_height <= buffer->capacity_height &&
+		buffer->capacity_width - buffer_width <= slack &&
+		buffer->capacity_height - buffer_height <= slack);
+}
+
+/*
+ * Let a released buffer show another size within its capacity. Only the
+ * wl_buffer is replaced, the data stays at the same range of the pool, with
+ * rows as long as the capacity.
+ */
+static void
+resize_shm_buffer(struct buffer *buffer,
+		  int width,
+		  int height,
+		  int scale)
+{
+	const int buffer_width = width * scale;
+	const int buffer_height = height * scale;
+
+	if (buffer->surface && buffer->scale != scale) {
+		cairo_surface_destroy(buffer->surface);
+		buffer->surface = NULL;
+	}
+
+	if (buffer->buffer_width != buffer_width ||
+	    buffer->buffer_height != buffer_height) {
+		if (buffer->surface) {
+			cairo_surface_destroy(buffer->surface);
+			buffer->surface = NULL;
+		}
+		wl_buffer_destroy(buffer->wl_buffer);
+		buffer->wl_buffer =
+			wl_shm_pool_create_buffer(buffer->pool->wl_shm_pool,
+						  buffer->offset,
+						  buffer_width, buffer_height,
+						  buffer->stride,
+						  buffer->format);
+		wl_buffer_add_listener(buffer->wl_buffer, &buffer_listener,
+				       buffer);
+	}
+
+	buffer->width = width;
+	buffer->height = height;
+	buffer->scale = scale;
+	buffer->buffer_width = buffer_width;
+	buffer->buffer_height = buffer_height;
+}
+
+/*
+ * Free a buffer, or, while the compositor may still read from it, detach it
+ * to be freed when released, as its range of the pool is reused.
+ */
+static void
+buffer_free(struct buffer *buffer)
+{
+	struct shm_pool *pool = buffer->pool;
+	struct shm_range *range;
+
+	if (pool && buffer->in_use) {
+		/* nothing draws into it anymore */
+		if (buffer->surface) {
+			cairo_surface_destroy(buffer->surface);
+			buffer->surface = NULL;
+		}
+		buffer->is_detached = true;
+		return;
+	}
+
+	wl_buffer_destroy(buffer->wl_buffer);
+	if (buffer->surface)
+		cairo_surface_destroy(buffer->surface);
+
+	if (pool) {
+		wl_list_remove(&buffer->link);
+		range = shm_pool_free_range(pool, buffer->offset,
+					    buffer->data_size);
+
+		/*
+		 * Keep the last pool around, to not create it again and again,
+		 * unless it was created for a single oversize buffer.
+		 */
+		if (wl_list_empty(&pool->buffer_list) &&
+		    (wl_list_length(&pool->plugin_cairo->shm_pool_list) > 1 ||
+		     pool->max_size > SHM_POOL_RESERVED_SIZE))
+			shm_pool_destroy(pool);
+		else
+			shm_pool_discard_range(pool, range);
+	}
+
+	free(buffer);
+}
+
+/*
+ * Cairo surface for drawing into the buffer, kept as long as the buffer size
+ * and scale do not change, to not set up a new one for each draw.
+ */
+static cairo_surface_t *
+get_buffer_surface(struct buffer *buffer)
+{
+	if (!buffer->surface) {
+		buffer->surface = cairo_image_surface_create_for_data(
+				  buffer->data, CAIRO_FORMAT_ARGB32,
+				  buffer->buffer_width, buffer->buffer_height,
+				  buffer->stride);
+		cairo_surface_set_device_scale(buffer->surface,
+					       buffer->scale, buffer->scale);
+	}
+
+	return buffer->surface;
+}
+
+/*
+ * Draw the shadow of a shadow surface of the given size, with the area of the
+ * main surface cut out.
+ */
+static void
+draw_shadow(cairo_t *cr, cairo_surface_t *shadow_blur, int width, int height)
+{
+	cairo_save(cr);
+	cairo_set_source_rgba(cr, 0.0, 0.0, 0.0, 0.0);
+	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+	cairo_paint(cr);
+	cairo_restore(cr);
+
+	render_shadow(cr,
+		      shadow_blur,
+		      -(int)SHADOW_MARGIN/2,
+		      -(int)SHADOW_MARGIN/2,
+		      width + SHADOW_MARGIN,
+		      height + SHADOW_MARGIN,
+		      SHADOW_TILE_BLUR_MARGIN,
+		      SHADOW_TILE_BLUR_MARGIN);
+
+	/* mask the toplevel surface */
+	cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
+	cairo_rectangle(cr, SHADOW_MARGIN, SHADOW_MARGIN + TITLE_HEIGHT,
+			width - 2 * SHADOW_MARGIN,
+			height - 2 * SHADOW_MARGIN - TITLE_HEIGHT);
+	cairo_fill(cr);
+}
+
+/*
+ * The nine-slice image is the shadow of the smallest shadow surface that
+ * still has a uniform part between its corners. As the shadow does not vary
+ * along the edges outside of the corners, any shadow can be composed from it.
+ */
+static struct buffer *
+get_shadow_slice_buffer(struct libdecor_plugin_cairo *plugin_cairo,
+			int scale)
+{
+	struct shadow_slice_buffer *slice_buffer;
+	struct buffer *buffer;
+	cairo_t *cr;
+	int size = 2 * SHADOW_SLICE_CORNER + SHADOW_SLICE_STRETCH;
+
+	wl_list_for_each(slice_buffer,
+			 &plugin_cairo->shadow_slice_buffer_list, link) {
+		if (slice_buffer->scale == scale)
+			return slice_buffer->buffer;
+	}
+
+	buffer = create_shm_buffer(plugin_cairo, size, size, false, scale);
+	if (!buffer)
+		return NULL;
+
+	cr = cairo_create(get_buffer_surface(buffer));
+	draw_shadow(cr,
+		    get_shadow_tile(plugin_cairo,
+				    SHADOW_TILE_SIZE,
+				    SHADOW_TILE_BOUNDARY,
+				    SHADOW_TILE_BLUR_MARGIN),
+		    size, size);
+	cairo_destroy(cr);
+
+	slice_buffer = zalloc(sizeof *slice_buffer);
+	slice_buffer->scale = scale;
+	slice_buffer->buffer = buffer;
+	wl_list_insert(&plugin_cairo->shadow_slice_buffer_list,
+		       &slice_buffer->link);
+
+	return buffer;
+}
+
+/*
+ * Expand the nine-slice image into the shadow of a buffer at least as large
+ * as the corners, directly in memory: corner rows are copied, the edges
+ * replicate the uniform middle row and column of the image and the middle
+ * rows, which lie within the main surface, are cleared.
+ */
+static void
+expand_shadow_slices(struct buffer *buffer,
+		     const struct buffer *slice_buffer)
+{
+	const int corner = SHADOW_SLICE_CORNER * buffer->scale;
+	const int far = (SHADOW_SLICE_CORNER + SHADOW_SLICE_STRETCH) *
+			buffer->scale;
+	const int middle = (SHADOW_SLICE_CORNER + SHADOW_SLICE_STRETCH / 2) *
+			   buffer->scale;
+	const int width = buffer->buffer_width;
+	const int height = buffer->buffer_height;
+	const int stride = buffer->stride / sizeof(uint32_t);
+	const int src_stride = slice_buffer->stride / sizeof(uint32_t);
+	const uint32_t *src = slice_buffer->data;
+	const uint32_t *middle_row = src + middle * src_stride;
+	const uint32_t *src_row;
+	uint32_t *row;
+	uint32_t edge;
+	int x, y;
+
+	for (y = 0; y < height; y++) {
+		row = (uint32_t *) buffer->data + y * stride;
+
+		if (y < corner)
+			src_row = src + y * src_stride;
+		else if (y >= height - corner)
+			src_row = src + (y - (height - corner) + far) * src_stride;
+		else
+			src_row = middle_row;
+
+		memcpy(row, src_row, corner * sizeof *row);
+		memcpy(row + width - corner, src_row + far,
+		       corner * sizeof *row);
+
+		if (src_row == middle_row) {
+			memset(row + corner, 0,
+			       (width - 2 * corner) * sizeof *row);
+		} else {
+			edge = src_row[middle];
+			for (x = corner; x < width - corner; x++)
+				row[x] = edge;
+		}
+	}
+}
+
+#ifdef HAS_SINGLE_PIXEL_BUFFER
+/*
+ * Single pixel buffer of the given color, without any buffer memory. Only
+ * used together with viewports, to stretch it to the intended size.
+ */
+static struct buffer *
+create_single_pixel_buffer(struct libdecor_plugin_cairo *plugin_cairo,
+			   uint32_t color)
+{
+	struct wp_single_pixel_buffer_manager_v1 *manager =
+		plugin_cairo->wp_single_pixel_buffer_manager;
+	/* expand the 8 bit channels to the full 32 bit range */
+	const uint32_t factor = UINT32_MAX / UINT8_MAX;
+	struct buffer *buffer;
+
+	buffer = zalloc(sizeof *buffer);
+	buffer->wl_buffer =
+		wp_single_pixel_buffer_manager_v1_create_u32_rgba_buffer(
+			manager,
+			((color >> 16) & 0xff) * factor,
+			((color >> 8) & 0xff) * factor,
+			(color & 0xff) * factor,
+			(color >> 24) * factor);
+	wl_buffer_add_listener(buffer->wl_buffer, &buffer_listener, buffer);
+
+	buffer->width = 1;
+	buffer->height = 1;
+	buffer->scale = 1;
+	buffer->buffer_width = 1;
+	buffer->buffer_height = 1;
+
+	return buffer;
+}
+#endif
+
+static struct buffer *
+get_solid_buffer(struct libdecor_plugin_cairo *plugin_cairo,
+		 uint32_t color)
+{
+	struct solid_buffer *solid_buffer;
+	struct buffer *buffer = NULL;
+
+	wl_list_for_each(solid_buffer, &plugin_cairo->solid_buffer_list, link) {
+		if (solid_buffer->color == color)
+			return solid_buffer->buffer;
+	}
+
+#ifdef HAS_SINGLE_PIXEL_BUFFER
+	if (plugin_cairo->wp_single_pixel_buffer_manager &&
+	    plugin_cairo->wp_viewporter)
+		buffer = create_single_pixel_buffer(plugin_cairo, color);
+#endif
+	if (!buffer) {
+		buffer = create_shm_buffer(plugin_cairo, 1, 1,
+					   (color >> 24) == 0xff, 1);
+		if (!buffer)
+			return NULL;
+
+		/*
+		 * only fully opaque or transparent colors, so no
+		 * premultiplication
+		 */
+		*(uint32_t *) buffer->data = color;
+	}
+
+	solid_buffer = zalloc(sizeof *solid_buffer);
+	solid_buffer->color = color;
+	solid_buffer->buffer = buffer;
+	wl_list_insert(&plugin_cairo->solid_buffer_list, &solid_buffer->link);
+
+	return buffer;
+}
+
+static void
+free_child_surface(struct child_surface *child)
+{
+	if (!child->wl_surface)
+		return;
+
+	wp_viewport_destroy(child->wp_viewport);
+	wl_subsurface_destroy(child->wl_subsurface);
+	wl_surface_destroy(child->wl_surface);
+	memset(child, 0, sizeof *child);
+}
+
+static void
+free_shadow_slices(struct libdecor_frame_cairo *frame_cairo)
+{
+	int i;
+
+	for (i = 0; i < SHADOW_SLICE_COUNT; i++)
+		free_child_surface(&frame_cairo->shadow_slices[i]);
+	frame_cairo->shadow_slices_scale = 0;
+}
+
+/* free a buffer of the component ring, forgetting any reference to it */
+static void
+free_component_buffer(struct border_component *border_component,
+		      unsigned int slot)
+{
+	struct buffer *buffer = border_component->server.buffers[slot];
+
+	if (border_component->server.buffer == buffer)
+		border_component->server.buffer = NULL;
+	if (border_component->server.alternate_buffer == buffer)
+		border_component->server.alternate_buffer = NULL;
+	if (border_component->server.attached_buffer == buffer)
+		border_component->server.attached_buffer = NULL;
+
+	buffer_free(buffer);
+	border_component->server.buffers[slot] = NULL;
+}
+
+static void
+free_component_buffers(struct border_component *border_component)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_LENGTH(border_component->server.buffers); i++) {
+		if (border_component->server.buffers[i])
+			free_component_buffer(border_component, i);
+	}
+	border_component->server.buffer = NULL;
+	border_component->server.alternate_buffer = NULL;
+	border_component->server.attached_buffer = NULL;
+}
+
+static void
+free_title_bar_parts(struct libdecor_frame_cairo *frame_cairo)
+{
+	unsigned int i;
+
+	free_child_surface(&frame_cairo->title_bar.text);
+	frame_cairo->title_bar.text_buffer = NULL;
+	frame_cairo->title_bar.is_text_showing = false;
+	free_child_surface(&frame_cairo->title_bar.cluster);
+	frame_cairo->title_bar.cluster_buffer = NULL;
+	for (i = 0; i < ARRAY_LENGTH(frame_cairo->title_bar.cluster_buffers); i++) {
+		if (frame_cairo->title_bar.cluster_buffers[i]) {
+			buffer_free(frame_cairo->title_bar.cluster_buffers[i]);
+			frame_cairo->title_bar.cluster_buffers[i] = NULL;
+		}
+	}
+	frame_cairo->title_bar.cluster_key = 0;
+}
+
+static void
+free_border_component(struct border_component *border_component)
+{
+	struct surface_output *surface_output, *surface_output_tmp;
+
+	if (border_component->server.wp_viewport) {
+		wp_viewport_destroy(border_component->server.wp_viewport);
+		border_component->server.wp_viewport = NULL;
+	}
+	if (border_component->server.wl_surface) {
+		wl_subsurface_destroy(border_component->server.wl_subsurface);
+		border_component->server.wl_subsurface = NULL;
+		wl_surface_destroy(border_component->server.wl_surface);
+		border_component->server.wl_surface = NULL;
+		memset(&border_component->server.opaque_region, 0,
+		       sizeof border_component->server.opaque_region);
+		memset(&border_component->server.input_region, 0,
+		       sizeof border_component->server.input_region);
+		memset(&border_component->server.input_region_hole, 0,
+		       sizeof border_component->server.input_region_hole);
+	}
+	free_component_buffers(border_component);
+	if (border_component->server.damage) {
+		cairo_region_destroy(border_component->server.damage);
+		border_component->server.damage = NULL;
+	}
+	if (border_component->server.output_list.next != NULL) {
+		wl_list_for_each_safe(surface_output, surface_output_tmp,
+				      &border_component->server.output_list, link) {
+			wl_list_remove(&surface_output->link);
+			free(surface_output);
+		}
+	}
+}
+
+static void
+invalidate_title_layout(struct libdecor_frame_cairo *frame_cairo)
+{
+	unsigned int i;
+
+	if (frame_cairo->title_layout.layout) {
+		g_object_unref(frame_cairo->title_layout.layout);
+		frame_cairo->title_layout.layout = NULL;
+	}
+
+	for (i = 0; i < ARRAY_LENGTH(frame_cairo->title_layout.images); i++) {
+		if (frame_cairo->title_layout.images[i]) {
+			cairo_surface_destroy(frame_cairo->title_layout.images[i]);
+			frame_cairo->title_layout.images[i] = NULL;
+		}
+		if (frame_cairo->title_layout.buffers[i]) {
+			buffer_free(frame_cairo->title_layout.buffers[i]);
+			frame_cairo->title_layout.buffers[i] = NULL;
+		}
+	}
+	frame_cairo->title_bar.text_buffer = NULL;
+}
+
+static void
+drop_redraw_callback(struct libdecor_frame_cairo *frame_cairo)
+{
+	if (frame_cairo->redraw_callback) {
+		wl_callback_destroy(frame_cairo->redraw_callback);
+		frame_cairo->redraw_callback = NULL;
+		frame_cairo->redraw_callback_surface = NULL;
+	}
+}
+
+static void
+libdecor_plugin_cairo_frame_free(struct libdecor_plugin *plugin,
+				 struct libdecor_frame *frame)
+{
+	struct libdecor_plugin_cairo *plugin_cairo =
+		(struct libdecor_plugin_cairo *) plugin;
+	struct libdecor_frame_cairo *frame_cairo =
+		(struct libdecor_frame_cairo *) frame;
+	struct seat *seat;
+
+	wl_list_for_each(seat, &plugin_cairo->seat_list, link) {
+		if (seat->pointer_focus != NULL &&
+		    wl_surface_get_user_data(seat->pointer_focus) == frame_cairo)
+			seat->pointer_focus = NULL;
+	}
+
+	free_title_bar_parts(frame_cairo);
+	free_border_component(&frame_cairo->title_bar.title);
+	free_border_component(&frame_cairo->title_bar.min);
+	free_border_component(&frame_cairo->title_bar.max);
+	free_border_component(&frame_cairo->title_bar.close);
+	frame_cairo->title_bar.is_showing = false;
+	free_shadow_slices(frame_cairo);
+	free_border_component(&frame_cairo->shadow);
+	frame_cairo->shadow_showing = false;
+	if (frame_cairo->shadow_blur != NULL) {
+		cairo_surface_destroy(frame_cairo->shadow_blur);
+		frame_cairo->shadow_blur = NULL;
+	}
+
+	free(frame_cairo->title);
+	frame_cairo->title = NULL;
+	invalidate_title_layout(frame_cairo);
+
+	if (frame_cairo->pending_commit_callback) {
+		wl_callback_destroy(frame_cairo->pending_commit_callback);
+		frame_cairo->pending_commit_callback = NULL;
+	}
+	drop_redraw_callback(frame_cairo);
+
+	frame_cairo->decoration_type = DECORATION_TYPE_NONE;
+
+	if (frame_cairo->link.next != NULL)
+		wl_list_remove(&frame_cairo->link);
+}
+
+static bool
+is_border_surfaces_showing(struct libdecor_frame_cairo *frame_cairo)
+{
+	return frame_cairo->shadow_showing;
+}
+
+static bool
+is_title_bar_surfaces_showing(struct libdecor_frame_cairo *frame_cairo)
+{
+	return frame_cairo->title_bar.is_showing;
+}
+
 static struct border_component *
 get_server_component(struct border_component *border_component)
 {
 	switch (border_component->composite_mode) {
 	case COMPOSITE_SERVER:
-		return border_component;
+		return border_component;
+	case COMPOSITE_CLIENT:
+		return get_server_component(border_component->client.parent_component);
+	}
+	return NULL;
+}
+
+static void
+redraw_border_component(struct libdecor_frame_cairo *frame_cairo,
+			struct border_component *border_component)
+{
+	struct border_component *server_component;
+
+	server_component = get_server_component(border_component);
+	draw_border_component(frame_cairo, server_component);
+}
+
+static void
+hide_border_component(struct libdecor_frame_cairo *frame_cairo,
+		      struct border_component *border_component)
+{
+	border_component->is_hidden = true;
+
+	switch (border_component->composite_mode) {
+	case COMPOSITE_SERVER:
+		if (!border_component->server.wl_surface)
+			return;
+
+		/* a hidden surface might never see its frame callback done */
+		if (frame_cairo->redraw_callback_surface ==
+		    border_component->server.wl_surface)
+			drop_redraw_callback(frame_cairo);
+
+		wl_surface_attach(border_component->server.wl_surface,
+				  NULL, 0, 0);
+		wl_surface_commit(border_component->server.wl_surface);
+		border_component->server.attached_buffer = NULL;
+		break;
+	case COMPOSITE_CLIENT:
+		redraw_border_component(frame_cairo, border_component);
+		break;
+	}
+}
+
+static void
+hide_border_surfaces(struct libdecor_frame_cairo *frame_cairo)
+{
+	hide_border_component(frame_cairo, &frame_cairo->shadow);
+	frame_cairo->shadow_showing = false;
+}
+
+static void
+hide_title_bar_surfaces(struct libdecor_frame_cairo *frame_cairo)
+{
+	hide_border_component(frame_cairo, &frame_cairo->title_bar.title);
+	hide_border_component(frame_cairo, &frame_cairo->title_bar.min);
+	hide_border_component(frame_cairo, &frame_cairo->title_bar.max);
+	hide_border_component(frame_cairo, &frame_cairo->title_bar.close);
+	frame_cairo->title_bar.is_showing = false;
+}
+
+static struct border_component *
+get_component_for_surface(struct libdecor_frame_cairo *frame_cairo,
+			  struct wl_surface *surface)
+{
+	if (frame_cairo->shadow.server.wl_surface == surface)
+		return &frame_cairo->shadow;
+	if (frame_cairo->title_bar.title.server.wl_surface == surface)
+		return &frame_cairo->title_bar.title;
+	return NULL;
+}
+
+static const cairo_rectangle_int_t *
+get_component_rectangle(struct libdecor_frame_cairo *frame_cairo,
+			enum component component);
+
+static void
+update_component_focus(struct libdecor_frame_cairo *frame_cairo,
+		       struct wl_surface *surface,
+		       struct seat *seat)
+{
+	struct border_component *border_component;
+	struct border_component *child_component;
+	struct border_component *focus_component;
+
+	border_component = get_component_for_surface(frame_cairo, surface);
+
+	focus_component = border_component;
+	wl_list_for_each(child_component, &border_component->child_components, link) {
+		const cairo_rectangle_int_t *rect =
+			get_component_rectangle(frame_cairo,
+						child_component->type);
+
+		if (seat->pointer_x >= rect->x &&
+		    seat->pointer_x < rect->x + rect->width &&
+		    seat->pointer_y >= rect->y &&
+		    seat->pointer_y < rect->y + rect->height) {
+			focus_component = child_component;
+			break;
+		}
+	}
+
+	if (frame_cairo->grab)
+		frame_cairo->active = frame_cairo->grab;
+	else
+		frame_cairo->active = focus_component;
+	frame_cairo->focus = focus_component;
+
+}
+
+static void
+mark_component_dirty(struct libdecor_frame_cairo *frame_cairo,
+		     struct border_component *border_component)
+{
+	frame_cairo->dirty_components |= 1 << border_component->type;
+}
+
+static bool
+is_component_dirty(struct libdecor_frame_cairo *frame_cairo,
+		   struct border_component *border_component)
+{
+	return frame_cairo->dirty_components & (1 << border_component->type);
+}
+
+static void
+mark_prelight_dirty(struct libdecor_frame_cairo *frame_cairo,
+		    struct border_component *border_component)
+{
+	if (!border_component)
+		return;
+
+	/* only buttons change their appearance when hovered or pressed */
+	switch (border_component->type) {
+	case BUTTON_MIN:
+	case BUTTON_MAX:
+	case BUTTON_CLOSE:
+		mark_component_dirty(frame_cairo, border_component);
+		break;
+	default:
+		break;
+	}
+}
+
+static void
+mark_buttons_dirty(struct libdecor_frame_cairo *frame_cairo)
+{
+	mark_component_dirty(frame_cairo, &frame_cairo->title_bar.min);
+	mark_component_dirty(frame_cairo, &frame_cairo->title_bar.max);
+	mark_component_dirty(frame_cairo, &frame_cairo->title_bar.close);
+}
+
+static bool
+draw_dirty_components(struct libdecor_frame_cairo *frame_cairo);
+
+static void
+flush_done(void *user_data,
+	   struct wl_callback *callback,
+	   uint32_t time)
+{
+	struct libdecor_plugin_cairo *plugin_cairo = user_data;
+
+	wl_callback_destroy(callback);
+	plugin_cairo->flush_callback = NULL;
+
+	flush_scheduled_redraws(plugin_cairo);
+}
+
+static const struct wl_callback_listener flush_listener = {
+	flush_done
+};
+
+/*
+ * Applications may dispatch the display without libdecor_dispatch(), make
+ * sure scheduled redraws are flushed once the events currently queued were
+ * handled in that case as well.
+ */
+static void
+schedule_flush(struct libdecor_plugin_cairo *plugin_cairo)
+{
+	struct wl_display *wl_display =
+		libdecor_get_wl_display(plugin_cairo->context);
+
+	if (plugin_cairo->flush_callback)
+		return;
+
+	plugin_cairo->flush_callback = wl_display_sync(wl_display);
+	wl_callback_add_listener(plugin_cairo->flush_callback,
+				 &flush_listener,
+				 plugin_cairo);
+}
+
+/*
+ * Schedule the components marked as dirty to be redrawn at the end of the
+ * current dispatch, but at most once per frame callback.
+ */
+static void
+schedule_redraw(struct libdecor_frame_cairo *frame_cairo,
+		bool needs_toplevel_commit)
+{
+	if (!frame_cairo->dirty_components)
+		return;
+
+	frame_cairo->needs_toplevel_commit |= needs_toplevel_commit;
+	if (!frame_cairo->redraw_callback)
+		schedule_flush(frame_cairo->plugin_cairo);
+}
+
+static void
+ensure_component(struct libdecor_frame_cairo *frame_cairo,
+		 struct border_component *cmpnt);
+
+static bool
+redraw_scale(struct libdecor_frame_cairo *frame_cairo,
+	     struct border_component *cmpnt)
+{
+	struct surface_output *surface_output;
+	int scale = 1;
+
+	if (cmpnt->is_hidden)
+		return false;
+
+	ensure_component(frame_cairo, cmpnt);
+
+	wl_list_for_each(surface_output, &cmpnt->server.output_list, link) {
+		scale = MAX(scale, surface_output->output->scale);
+	}
+	if (scale != cmpnt->server.scale) {
+		cmpnt->server.scale = scale;
+		if ((cmpnt->type != SHADOW) || is_border_surfaces_showing(frame_cairo)) {
+			mark_component_dirty(frame_cairo, cmpnt);
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool
+add_surface_output(struct libdecor_plugin_cairo *plugin_cairo,
+		   struct wl_output *wl_output,
+		   struct wl_list *list)
+{
+	struct output *output;
+	struct surface_output *surface_output;
+
+	if (!own_output(wl_output))
+		return false;
+
+	output = wl_output_get_user_data(wl_output);
+
+	if (output == NULL)
+		return false;
+
+	surface_output = zalloc(sizeof *surface_output);
+	surface_output->output = output;
+	wl_list_insert(list, &surface_output->link);
+	return true;
+}
+
+static void
+surface_enter(void *data,
+	      struct wl_surface *wl_surface,
+	      struct wl_output *wl_output)
+{
+	struct libdecor_frame_cairo *frame_cairo = data;
+	struct border_component *cmpnt;
+
+	if (!(own_surface(wl_surface) && own_output(wl_output)))
+	    return;
+
+	cmpnt = get_component_for_surface(frame_cairo, wl_surface);
+	if (cmpnt == NULL)
+		return;
+
+	if (!add_surface_output(frame_cairo->plugin_cairo, wl_output,
+				&cmpnt->server.output_list))
+		return;
+
+	if (redraw_scale(frame_cairo, cmpnt))
+		schedule_redraw(frame_cairo, true);
+}
+
+static bool
+remove_surface_output(struct wl_list *list, struct wl_output *wl_output)
+{
+	struct surface_output *surface_output;
+	wl_list_for_each(surface_output, list, link) {
+		if (surface_output->output->wl_output == wl_output) {
+			wl_list_remove(&surface_output->link);
+			free(surface_output);
+			return true;
+		}
+	}
+	return false;
+}
+
+static void
+surface_leave(void *data,
+	      struct wl_surface *wl_surface,
+	      struct wl_output *wl_output)
+{
+	struct libdecor_frame_cairo *frame_cairo = data;
+	struct border_component *cmpnt;
+
+	if (!(own_surface(wl_surface) && own_output(wl_output)))
+	    return;
+
+	cmpnt = get_component_for_surface(frame_cairo, wl_surface);
+	if (cmpnt == NULL)
+		return;
+
+	if (!remove_surface_output(&cmpnt->server.output_list, wl_output))
+		return;
+
+	if (redraw_scale(frame_cairo, cmpnt))
+		schedule_redraw(frame_cairo, true);
+}
+
+static struct wl_surface_listener surface_listener = {
+	surface_enter,
+	surface_leave,
+};
+
+static void
+create_surface_subsurface_pair(struct libdecor_frame_cairo *frame_cairo,
+			       struct wl_surface **out_wl_surface,
+			       struct wl_subsurface **out_wl_subsurface)
+{
+	struct libdecor_plugin_cairo *plugin_cairo = frame_cairo->plugin_cairo;
+	struct libdecor_frame *frame = &frame_cairo->frame;
+	struct wl_compositor *wl_compositor = plugin_cairo->wl_compositor;
+	struct wl_subcompositor *wl_subcompositor = plugin_cairo->wl_subcompositor;
+	struct wl_surface *wl_surface;
+	struct wl_surface *parent;
+	struct wl_subsurface *wl_subsurface;
+
+	wl_surface = wl_compositor_create_surface(wl_compositor);
+	wl_proxy_set_tag((struct wl_proxy *) wl_surface,
+			 &libdecor_cairo_proxy_tag);
+
+	parent = libdecor_frame_get_wl_surface(frame);
+	wl_subsurface = wl_subcompositor_get_subsurface(wl_subcompositor,
+							wl_surface,
+							parent);
+
+	*out_wl_surface = wl_surface;
+	*out_wl_subsurface = wl_subsurface;
+}
+
+static void
+ensure_component(struct libdecor_frame_cairo *frame_cairo,
+		 struct border_component *cmpnt)
+{
+	switch (cmpnt->composite_mode) {
+	case COMPOSITE_SERVER:
+		if (!cmpnt->server.wl_surface) {
+			wl_list_init(&cmpnt->server.output_list);
+			cmpnt->server.scale = 1;
+			create_surface_subsurface_pair(frame_cairo,
+						       &cmpnt->server.wl_surface,
+						       &cmpnt->server.wl_subsurface);
+			wl_surface_add_listener(cmpnt->server.wl_surface,
+						&surface_listener,
+						frame_cairo);
+		}
+		break;
+	case COMPOSITE_CLIENT:
+			wl_list_init(&cmpnt->server.output_list);
+		break;
+	}
+
+	cmpnt->is_hidden = false;
+}
+
+static void
+ensure_border_surfaces(struct libdecor_frame_cairo *frame_cairo)
+{
+	frame_cairo->shadow.opaque = false;
+	ensure_component(frame_cairo, &frame_cairo->shadow);
+
+	if (!frame_cairo->shadow_blur)
+		frame_cairo->shadow_blur = cairo_surface_reference(
+			get_shadow_tile(frame_cairo->plugin_cairo,
+					SHADOW_TILE_SIZE,
+					SHADOW_TILE_BOUNDARY,
+					SHADOW_TILE_BLUR_MARGIN));
+
+	libdecor_frame_set_min_content_size(&frame_cairo->frame,
+					    MAX(56, 4 * BUTTON_WIDTH),
+					    MAX(56, TITLE_HEIGHT + 1));
+}
+
+static void
+ensure_title_bar_surfaces(struct libdecor_frame_cairo *frame_cairo)
+{
+	frame_cairo->title_bar.title.opaque = true;
+	ensure_component(frame_cairo, &frame_cairo->title_bar.title);
+
+	frame_cairo->title_bar.min.opaque = true;
+	ensure_component(frame_cairo, &frame_cairo->title_bar.min);
+
+	frame_cairo->title_bar.max.opaque = true;
+	ensure_component(frame_cairo, &frame_cairo->title_bar.max);
+
+	frame_cairo->title_bar.close.opaque = true;
+	ensure_component(frame_cairo, &frame_cairo->title_bar.close);
+}
+
+static void
+compute_component_rectangle(enum component component,
+			    int content_width,
+			    int content_height,
+			    cairo_rectangle_int_t *rect)
+{
+	switch (component) {
+	case NONE:
+		*rect = (cairo_rectangle_int_t) { 0 };
+		return;
+	case SHADOW:
+		rect->x = -(int)SHADOW_MARGIN;
+		rect->y = -(int)(SHADOW_MARGIN+TITLE_HEIGHT);
+		rect->width = content_width + 2 * SHADOW_MARGIN;
+		rect->height = content_height
+			       + 2 * SHADOW_MARGIN
+			       + TITLE_HEIGHT;
+		return;
+	case TITLE:
+		rect->x = 0;
+		rect->y = -(int)TITLE_HEIGHT;
+		rect->width = content_width;
+		rect->height = TITLE_HEIGHT;
+		return;
+	case BUTTON_MIN:
+		rect->x = content_width - 3 * BUTTON_WIDTH;
+		rect->y = 0;
+		rect->width = BUTTON_WIDTH;
+		rect->height = TITLE_HEIGHT;
+		return;
+	case BUTTON_MAX:
+		rect->x = content_width - 2 * BUTTON_WIDTH;
+		rect->y = 0;
+		rect->width = BUTTON_WIDTH;
+		rect->height = TITLE_HEIGHT;
+		return;
+	case BUTTON_CLOSE:
+		rect->x = content_width - BUTTON_WIDTH;
+		rect->y = 0;
+		rect->width = BUTTON_WIDTH;
+		rect->height = TITLE_HEIGHT;
+		return;
+	}
+
+	abort();
+}
+
+/*
+ * The decoration layout only depends on the content size, recompute it when
+ * that changed since it was last used.
+ */
+static void
+ensure_layout(struct libdecor_frame_cairo *frame_cairo)
+{
+	struct libdecor_frame *frame = &frame_cairo->frame;
+	int content_width, content_height;
+	const cairo_rectangle_int_t *shadow;
+	enum component component;
+
+	content_width = libdecor_frame_get_content_width(frame);
+	content_height = libdecor_frame_get_content_height(frame);
+
+	if (frame_cairo->layout.is_valid &&
+	    frame_cairo->layout.content_width == content_width &&
+	    frame_cairo->layout.content_height == content_height)
+		return;
+
+	for (component = NONE; component <= BUTTON_CLOSE; component++)
+		compute_component_rectangle(
+			component, content_width, content_height,
+			&frame_cairo->layout.components[component]);
+
+	shadow = &frame_cairo->layout.components[SHADOW];
+	frame_cairo->layout.edge_left = SHADOW_MARGIN;
+	frame_cairo->layout.edge_right = shadow->width - SHADOW_MARGIN;
+	frame_cairo->layout.edge_top = SHADOW_MARGIN;
+	frame_cairo->layout.edge_bottom = shadow->height - SHADOW_MARGIN;
+
+	frame_cairo->layout.content_width = content_width;
+	frame_cairo->layout.content_height = content_height;
+	frame_cairo->layout.is_valid = true;
+}
+
+static const cairo_rectangle_int_t *
+get_component_rectangle(struct libdecor_frame_cairo *frame_cairo,
+			enum component component)
+{
+	ensure_layout(frame_cairo);
+	return &frame_cairo->layout.components[component];
+}
+
+static void
+calculate_component_size(struct libdecor_frame_cairo *frame_cairo,
+			 enum component component,
+			 int *component_x,
+			 int *component_y,
+			 int *component_width,
+			 int *component_height)
+{
+	const cairo_rectangle_int_t *rect =
+		get_component_rectangle(frame_cairo, component);
+
+	*component_x = rect->x;
+	*component_y = rect->y;
+	*component_width = rect->width;
+	*component_height = rect->height;
+}
+
+static int
+border_component_get_scale(struct border_component *border_component)
+{
+	switch (border_component->composite_mode) {
+	case COMPOSITE_SERVER:
+		return border_component->server.scale;
 	case COMPOSITE_CLIENT:
-		return get_server_component(border_component->client.parent_component);
+		return border_component_get_scale(
+				border_component->client.parent_component);
 	}
-	return NULL;
+	return 0;
+}
+
+static PangoLayout *
+ensure_title_layout(struct libdecor_frame_cairo *frame_cairo,
+		    cairo_t *cr,
+		    const char *title,
+		    int scale)
+{
+	PangoLayout *layout = frame_cairo->title_layout.layout;
+	PangoContext *context;
+	int text_extents_width, text_extents_height;
+
+	if (layout && frame_cairo->title_layout.scale != scale)
+		invalidate_title_layout(frame_cairo);
+
+	if (frame_cairo->title_layout.layout) {
+		/* only re-shaped if the cairo context properties differ */
+		pango_cairo_update_layout(cr, layout);
+		return layout;
+	}
+
+	context = pango_font_map_create_context(
+			get_font_map(frame_cairo->plugin_cairo));
+	pango_cairo_update_context(cr, context);
+	layout = pango_layout_new(context);
+	g_object_unref(context);
+	pango_layout_set_text(layout,
+			      title,
+			      -1);
+	pango_layout_set_font_description(layout, frame_cairo->plugin_cairo->font);
+	pango_layout_get_size(layout, &text_extents_width, &text_extents_height);
+	pango_layout_get_pixel_extents(layout,
+				       &frame_cairo->title_layout.ink_rect,
+				       NULL);
+
+	frame_cairo->title_layout.layout = layout;
+	frame_cairo->title_layout.scale = scale;
+	frame_cairo->title_layout.text_width = text_extents_width / PANGO_SCALE;
+	frame_cairo->title_layout.text_height = text_extents_height / PANGO_SCALE;
+
+	return layout;
 }
 
+/*
+ * Rasterize the title text once per title, scale and activation state, so
+ * that redraws, e.g. during interactive resizing, only composite the image.
+ */
+static cairo_surface_t *
+ensure_title_image(struct libdecor_frame_cairo *frame_cairo,
+		   cairo_t *cr,
+		   const char *title,
+		   int scale,
+		   bool active)
+{
+	const uint32_t col_title_text = active ? COL_SYM : COL_SYM_INACT;
+	const PangoRectangle *ink_rect;
+	PangoLayout *layout;
+	cairo_surface_t *image;
+	cairo_t *image_cr;
+
+	layout = ensure_title_layout(frame_cairo, cr, title, scale);
+
+	image = frame_cairo->title_layout.images[active];
+	if (image)
+		return image;
+
+	ink_rect = &frame_cairo->title_layout.ink_rect;
+	if (ink_rect->width <= 0 || ink_rect->height <= 0)
+		return NULL;
+
+	image = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+					   ink_rect->width * scale,
+					   ink_rect->height * scale);
+	cairo_surface_set_device_scale(image, scale, scale);
+
+	image_cr = cairo_create(image);
+	pango_cairo_update_layout(image_cr, layout);
+	cairo_move_to(image_cr, -ink_rect->x, -ink_rect->y);
+	cairo_set_rgba32(image_cr, &col_title_text);
+	pango_cairo_show_layout(image_cr, layout);
+	cairo_destroy(image_cr);
+
+	frame_cairo->title_layout.images[active] = image;
+
+	return image;
+}
+
+/* title text position, given the shaped title layout */
 static void
-redraw_border_component(struct libdecor_frame_cairo *frame_cairo,
-			struct border_component *border_component)
+calculate_title_text_position(struct libdecor_frame_cairo *frame_cairo,
+			      int title_width,
+			      double *text_x,
+			      double *text_y)
 {
-	struct border_component *server_component;
+	const int fade_width = 5 * BUTTON_WIDTH;
+	double text_width, text_height;
 
-	server_component = get_server_component(border_component);
-	draw_border_component(frame_cairo, server_component);
+	text_width = frame_cairo->title_layout.text_width;
+	text_height = frame_cairo->title_layout.text_height;
+	*text_x = title_width / 2.0 - text_width / 2.0;
+	*text_x += MIN(0.0, ((title_width - fade_width) - (*text_x + text_width)));
+	*text_x = MAX(*text_x, BUTTON_WIDTH);
+	*text_y = TITLE_HEIGHT / 2.0 - text_height / 2.0;
+}
+
+/* fade-out from title text to buttons, starting at the given position */
+static cairo_pattern_t *
+create_title_fade(uint32_t col_title, int fade_start)
+{
+	cairo_pattern_t *fade;
+
+	fade = cairo_pattern_create_linear(fade_start, 0,
+					   fade_start + 2 * BUTTON_WIDTH, 0);
+	cairo_pattern_add_color_stop_rgba(fade, 0,
+					  red(&col_title),
+					  green(&col_title),
+					  blue(&col_title),
+					  0);
+	cairo_pattern_add_color_stop_rgb(fade, 1,
+					 red(&col_title),
+					 green(&col_title),
+					 blue(&col_title));
+
+	return fade;
 }
 
 static void
-hide_border_component(struct libdecor_frame_cairo *frame_cairo,
-		      struct border_component *border_component)
+draw_title_text(struct libdecor_frame_cairo *frame_cairo,
+		cairo_t *cr,
+		const int *title_width,
+		int scale,
+		bool active)
 {
-	border_component->is_hidden = true;
+	const uint32_t col_title = active ? COL_TITLE : COL_TITLE_INACT;
 
-	switch (border_component->composite_mode) {
-	case COMPOSITE_SERVER:
-		if (!border_component->server.wl_surface)
-			return;
+	cairo_surface_t *image;
 
-		wl_surface_attach(border_component->server.wl_surface,
-				  NULL, 0, 0);
-		wl_surface_commit(border_component->server.wl_surface);
+	/* title fade out at buttons */
+	const int fade_width = 5 * BUTTON_WIDTH;
+	int fade_start;
+	cairo_pattern_t *fade;
+
+	/* text position */
+	double text_x, text_y;
+
+	const char *title;
+
+	title = libdecor_frame_get_title((struct libdecor_frame*) frame_cairo);
+	if (!title)
+		return;
+
+	image = ensure_title_image(frame_cairo, cr, title, scale, active);
+
+	calculate_title_text_position(frame_cairo, *title_width,
+				      &text_x, &text_y);
+
+	/* draw title text, aligned to the pixel grid to keep it sharp */
+	if (image) {
+		text_x = round((text_x + frame_cairo->title_layout.ink_rect.x) *
+			       scale) / scale;
+		text_y = round((text_y + frame_cairo->title_layout.ink_rect.y) *
+			       scale) / scale;
+		cairo_set_source_surface(cr, image, text_x, text_y);
+		cairo_paint(cr);
+	}
+
+	/* draw fade-out from title text to buttons */
+	fade_start = *title_width - fade_width;
+	fade = create_title_fade(col_title, fade_start);
+	cairo_rectangle(cr, fade_start, 0, fade_width, TITLE_HEIGHT);
+	cairo_set_source(cr, fade);
+	cairo_fill(cr);
+
+	cairo_pattern_destroy(fade);
+}
+
+static uint32_t
+button_glyph_color(enum button_glyph glyph)
+{
+	switch (glyph) {
+	case BUTTON_GLYPH_MIN:
+		return COL_BUTTON_MIN;
+	case BUTTON_GLYPH_MAX:
+	case BUTTON_GLYPH_RESTORE:
+		return COL_BUTTON_MAX;
+	case BUTTON_GLYPH_CLOSE:
+	default:
+		return COL_BUTTON_CLOSE;
+	}
+}
+
+static void
+draw_button_sprite(cairo_t *cr,
+		   enum button_glyph glyph,
+		   enum button_state state)
+{
+	/* button symbol origin */
+	const double x = BUTTON_WIDTH / 2 - SYM_DIM / 2 + 0.5;
+	const double y = TITLE_HEIGHT / 2 - SYM_DIM / 2 + 0.5;
+	const uint32_t col_button = button_glyph_color(glyph);
+
+	/* background */
+	switch (state) {
+	case BUTTON_STATE_NORMAL:
+	case BUTTON_STATE_DISABLED:
+		cairo_set_rgba32(cr, &COL_TITLE);
 		break;
-	case COMPOSITE_CLIENT:
-		redraw_border_component(frame_cairo, border_component);
+	case BUTTON_STATE_PRELIGHT:
+		cairo_set_rgba32(cr, &col_button);
+		break;
+	case BUTTON_STATE_INACTIVE:
+		cairo_set_rgba32(cr, &COL_TITLE_INACT);
+		break;
+	case BUTTON_STATE_INACTIVE_PRELIGHT:
+		cairo_set_rgba32(cr, &COL_BUTTON_INACT);
+		break;
+	default:
+		break;
+	}
+	cairo_rectangle(cr, 0, 0, BUTTON_WIDTH, TITLE_HEIGHT);
+	cairo_fill(cr);
+
+	/* button symbols */
+	switch (state) {
+	case BUTTON_STATE_NORMAL:
+		cairo_set_rgba32(cr, &COL_SYM);
+		break;
+	case BUTTON_STATE_PRELIGHT:
+	case BUTTON_STATE_DISABLED:
+		/* active (a.k.a. prelight) */
+		cairo_set_rgba32(cr, &COL_SYM_ACT);
+		break;
+	case BUTTON_STATE_INACTIVE:
+	case BUTTON_STATE_INACTIVE_PRELIGHT:
+		/* inactive: use single desaturated color */
+		cairo_set_rgba32(cr, &COL_SYM_INACT);
+		break;
+	default:
+		break;
+	}
+
+	/* https://www.cairographics.org/FAQ/#sharp_lines */
+	cairo_set_line_width(cr, 1);
+
+	switch (glyph) {
+	case BUTTON_GLYPH_MIN:
+		cairo_move_to(cr, x, y + SYM_DIM - 1);
+		cairo_rel_line_to(cr, SYM_DIM - 1, 0);
+		break;
+	case BUTTON_GLYPH_MAX:
+		cairo_rectangle(cr, x, y, SYM_DIM - 1, SYM_DIM - 1);
+		break;
+	case BUTTON_GLYPH_RESTORE: {
+		const size_t small = 12;
+		cairo_rectangle(cr,
+				x,
+				y + SYM_DIM - small,
+				small - 1,
+				small - 1);
+		cairo_move_to(cr,
+			      x + SYM_DIM - small,
+			      y + SYM_DIM - small);
+		cairo_line_to(cr, x + SYM_DIM - small, y);
+		cairo_rel_line_to(cr, small - 1, 0);
+		cairo_rel_line_to(cr, 0, small - 1);
+		cairo_line_to(cr, x + small - 1, y + small - 1);
+		break;
+	}
+	case BUTTON_GLYPH_CLOSE:
+		cairo_move_to(cr, x, y);
+		cairo_rel_line_to(cr, SYM_DIM - 1, SYM_DIM - 1);
+		cairo_move_to(cr, x + SYM_DIM - 1, y);
+		cairo_line_to(cr, x, y + SYM_DIM - 1);
+		break;
+	default:
 		break;
 	}
+	cairo_stroke(cr);
 }
 
-static void
-hide_border_surfaces(struct libdecor_frame_cairo *frame_cairo)
+static cairo_surface_t *
+get_button_atlas(struct libdecor_plugin_cairo *plugin_cairo,
+		 int scale)
 {
-	hide_border_component(frame_cairo, &frame_cairo->shadow);
-	frame_cairo->shadow_showing = false;
+	struct button_atlas *atlas;
+	cairo_t *cr;
+	int glyph, state;
+
+	wl_list_for_each(atlas, &plugin_cairo->button_atlas_list, link) {
+		if (atlas->scale == scale)
+			return atlas->image;
+	}
+
+	atlas = zalloc(sizeof *atlas);
+	atlas->scale = scale;
+	atlas->image = cairo_image_surface_create(
+				CAIRO_FORMAT_ARGB32,
+				BUTTON_STATE_COUNT * BUTTON_WIDTH * scale,
+				BUTTON_GLYPH_COUNT * TITLE_HEIGHT * scale);
+	cairo_surface_set_device_scale(atlas->image, scale, scale);
+
+	cr = cairo_create(atlas->image);
+	for (glyph = 0; glyph < BUTTON_GLYPH_COUNT; glyph++) {
+		for (state = 0; state < BUTTON_STATE_COUNT; state++) {
+			cairo_save(cr);
+			cairo_translate(cr,
+					state * BUTTON_WIDTH,
+					glyph * TITLE_HEIGHT);
+			cairo_rectangle(cr, 0, 0, BUTTON_WIDTH, TITLE_HEIGHT);
+			cairo_clip(cr);
+			draw_button_sprite(cr, glyph, state);
+			cairo_restore(cr);
+		}
+	}
+	cairo_destroy(cr);
+
+	wl_list_insert(&plugin_cairo->button_atlas_list, &atlas->link);
+
+	return atlas->image;
 }
 
 static void
-hide_title_bar_surfaces(struct libdecor_frame_cairo *frame_cairo)
+get_button_sprite(struct libdecor_frame_cairo *frame_cairo,
+		  enum component component,
+		  enum button_glyph *out_glyph,
+		  enum button_state *out_state)
 {
-	hide_border_component(frame_cairo, &frame_cairo->title_bar.title);
-	hide_border_component(frame_cairo, &frame_cairo->title_bar.min);
-	hide_border_component(frame_cairo, &frame_cairo->title_bar.max);
-	hide_border_component(frame_cairo, &frame_cairo->title_bar.close);
-	frame_cairo->title_bar.is_showing = false;
+	struct border_component *border_component = NULL;
+	enum libdecor_window_state window_state;
+	enum button_glyph glyph = BUTTON_GLYPH_MIN;
+	enum button_state state;
+	bool capable = false;
+	bool active;
+	bool prelight;
+
+	window_state = libdecor_frame_get_window_state(&frame_cairo->frame);
+	active = window_state & LIBDECOR_WINDOW_STATE_ACTIVE;
+
+	switch (component) {
+	case BUTTON_MIN:
+		border_component = &frame_cairo->title_bar.min;
+		glyph = BUTTON_GLYPH_MIN;
+		capable = minimizable(frame_cairo);
+		break;
+	case BUTTON_MAX:
+		border_component = &frame_cairo->title_bar.max;
+		if (window_state & LIBDECOR_WINDOW_STATE_MAXIMIZED)
+			glyph = BUTTON_GLYPH_RESTORE;
+		else
+			glyph = BUTTON_GLYPH_MAX;
+		capable = resizable(frame_cairo);
+		break;
+	case BUTTON_CLOSE:
+		border_component = &frame_cairo->title_bar.close;
+		glyph = BUTTON_GLYPH_CLOSE;
+		capable = closeable(frame_cairo);
+		break;
+	default:
+		abort();
+	}
+
+	prelight = frame_cairo->active == border_component;
+
+	if (!active)
+		state = (capable && prelight) ? BUTTON_STATE_INACTIVE_PRELIGHT :
+						BUTTON_STATE_INACTIVE;
+	else if (!capable)
+		state = BUTTON_STATE_DISABLED;
+	else
+		state = prelight ? BUTTON_STATE_PRELIGHT : BUTTON_STATE_NORMAL;
+
+	*out_glyph = glyph;
+	*out_state = state;
 }
 
-static struct border_component *
-get_component_for_surface(struct libdecor_frame_cairo *frame_cairo,
-			  struct wl_surface *surface)
+static void
+draw_button(struct libdecor_frame_cairo *frame_cairo,
+	    cairo_t *cr,
+	    enum component component,
+	    int scale)
 {
-	if (frame_cairo->shadow.server.wl_surface == surface)
-		return &frame_cairo->shadow;
-	if (frame_cairo->title_bar.title.server.wl_surface == surface)
-		return &frame_cairo->title_bar.title;
-	return NULL;
+	enum button_glyph glyph;
+	enum button_state state;
+
+	get_button_sprite(frame_cairo, component, &glyph, &state);
+
+	cairo_save(cr);
+	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+	cairo_set_source_surface(cr,
+				 get_button_atlas(frame_cairo->plugin_cairo,
+						  scale),
+				 -(int)(state * BUTTON_WIDTH),
+				 -(int)(glyph * TITLE_HEIGHT));
+	cairo_rectangle(cr, 0, 0, BUTTON_WIDTH, TITLE_HEIGHT);
+	cairo_fill(cr);
+	cairo_restore(cr);
 }
 
+/* add an area, in surface coordinates, to the damage of a server component */
 static void
-calculate_component_size(struct libdecor_frame_cairo *frame_cairo,
-			 enum component component,
-			 int *component_x,
-			 int *component_y,
-			 int *component_width,
-			 int *component_height);
+damage_server_component(struct border_component *border_component,
+			int x,
+			int y,
+			int width,
+			int height)
+{
+	const int scale = border_component->server.buffer->scale;
+	const cairo_rectangle_int_t rectangle = {
+		x * scale, y * scale, width * scale, height * scale,
+	};
+
+	if (!border_component->server.damage)
+		border_component->server.damage = cairo_region_create();
+	cairo_region_union_rectangle(border_component->server.damage,
+				     &rectangle);
+}
+
+/*
+ * Cairo context for drawing a client component into the buffer of its server
+ * component, confined to the component.
+ */
+static cairo_t *
+create_cairo_for_parent(struct border_component *border_component,
+			int component_x,
+			int component_y,
+			int component_width,
+			int component_height)
+{
+	struct border_component *server_component;
+	cairo_t *cr;
+
+	server_component = get_server_component(border_component);
+	cr = cairo_create(get_buffer_surface(server_component->server.buffer));
+	cairo_translate(cr, component_x, component_y);
+	cairo_rectangle(cr, 0, 0, component_width, component_height);
+	cairo_clip(cr);
+
+	return cr;
+}
 
 static void
-update_component_focus(struct libdecor_frame_cairo *frame_cairo,
-		       struct wl_surface *surface,
-		       struct seat *seat)
+draw_component_content(struct libdecor_frame_cairo *frame_cairo,
+		       struct border_component *border_component,
+		       int component_x,
+		       int component_y,
+		       int component_width,
+		       int component_height,
+		       enum component component)
 {
-	static struct border_component *border_component;
-	static struct border_component *child_component;
-	static struct border_component *focus_component;
-
-	border_component = get_component_for_surface(frame_cairo, surface);
+	struct buffer *buffer = NULL;
+	struct buffer *slice_buffer;
+	cairo_surface_t *surface = NULL;
+	int width = 0, height = 0;
+	int scale;
+	cairo_t *cr;
 
-	focus_component = border_component;
-	wl_list_for_each(child_component, &border_component->child_components, link) {
-		int component_x = 0, component_y = 0;
-		int component_width = 0, component_height = 0;
+	enum libdecor_window_state state;
 
-		calculate_component_size(frame_cairo, child_component->type,
-					 &component_x, &component_y,
-					 &component_width, &component_height);
-		if (seat->pointer_x >= component_x &&
-		    seat->pointer_x < component_x + component_width &&
-		    seat->pointer_y >= component_y &&
-		    seat->pointer_y < component_y + component_height) {
-			focus_component = child_component;
-			break;
-		}
-	}
+	bool active;
 
-	if (frame_cairo->grab)
-		frame_cairo->active = frame_cairo->grab;
-	else
-		frame_cairo->active = focus_component;
-	frame_cairo->focus = focus_component;
+	uint32_t col_title;
 
-}
+	scale = border_component_get_scale(border_component);
 
-static void
-ensure_component(struct libdecor_frame_cairo *frame_cairo,
-		 struct border_component *cmpnt);
+	state = libdecor_frame_get_window_state((struct libdecor_frame *) frame_cairo);
 
-static bool
-redraw_scale(struct libdecor_frame_cairo *frame_cairo,
-	     struct border_component *cmpnt)
-{
-	struct surface_output *surface_output;
-	int scale = 1;
+	active = state & LIBDECOR_WINDOW_STATE_ACTIVE;
 
-	if (cmpnt->is_hidden)
-		return false;
+	col_title = active ? COL_TITLE : COL_TITLE_INACT;
 
-	ensure_component(frame_cairo, cmpnt);
+	switch (border_component->composite_mode) {
+	case COMPOSITE_SERVER:
+		buffer = border_component->server.buffer;
 
-	wl_list_for_each(surface_output, &cmpnt->server.output_list, link) {
-		scale = MAX(scale, surface_output->output->scale);
+		surface = get_buffer_surface(buffer);
+		cr = cairo_create(surface);
+		width = buffer->width;
+		height = buffer->height;
+		damage_server_component(border_component, 0, 0, width, height);
+		break;
+	case COMPOSITE_CLIENT:
+		cr = create_cairo_for_parent(border_component,
+					     component_x, component_y,
+					     component_width, component_height);
+		width = component_width;
+		height = component_height;
+		damage_server_component(get_server_component(border_component),
+					component_x, component_y,
+					width, height);
+		break;
 	}
-	if (scale != cmpnt->server.scale) {
-		cmpnt->server.scale = scale;
-		if ((cmpnt->type != SHADOW) || is_border_surfaces_showing(frame_cairo)) {
-			draw_border_component(frame_cairo, cmpnt);
-			return true;
+
+	switch (component) {
+	case NONE:
+		break;
+	case SHADOW:
+		slice_buffer = NULL;
+		if (buffer &&
+		    width >= 2 * SHADOW_SLICE_CORNER &&
+		    height >= 2 * SHADOW_SLICE_CORNER)
+			slice_buffer = get_shadow_slice_buffer(
+				frame_cairo->plugin_cairo, buffer->scale);
+		if (slice_buffer) {
+			cairo_surface_flush(surface);
+			expand_shadow_slices(buffer, slice_buffer);
+			cairo_surface_mark_dirty(surface);
+		} else {
+			draw_shadow(cr, frame_cairo->shadow_blur,
+				    width, height);
 		}
+		break;
+	case TITLE:
+		cairo_set_rgba32(cr, &col_title);
+		cairo_paint(cr);
+		draw_title_text(frame_cairo, cr, &component_width, scale, active);
+		break;
+	case BUTTON_MIN:
+	case BUTTON_MAX:
+	case BUTTON_CLOSE:
+		/* buttons are fully covered by their sprite */
+		draw_button(frame_cairo, cr, component, scale);
+		break;
 	}
-	return false;
+
+	cairo_destroy(cr);
 }
 
 static bool
-add_surface_output(struct libdecor_plugin_cairo *plugin_cairo,
-		   struct wl_output *wl_output,
-		   struct wl_list *list)
+rectangle_equal(const cairo_rectangle_int_t *a,
+		const cairo_rectangle_int_t *b)
 {
-	struct output *output;
-	struct surface_output *surface_output;
+	return (a->x == b->x && a->y == b->y &&
+		a->width == b->width && a->height == b->height);
+}
 
-	if (!own_output(wl_output))
-		return false;
+/*
+ * Set the input region, only when its geometry differs from the one set
+ * last, e.g. after the content size or decoration type changed.
+ */
+static void
+set_component_input_region(struct libdecor_frame_cairo *frame_cairo,
+			   struct border_component *border_component)
+{
+	if (border_component->type == SHADOW && frame_cairo->shadow_showing) {
+		struct wl_region *input_region;
+		cairo_rectangle_int_t outer;
+		cairo_rectangle_int_t hole;
+		int component_x;
+		int component_y;
+		int component_width;
+		int component_height;
 
-	output = wl_output_get_user_data(wl_output);
+		calculate_component_size(frame_cairo, border_component->type,
+					 &component_x, &component_y,
+					 &component_width, &component_height);
 
-	if (output == NULL)
-		return false;
+		/*
+		 * the input region is the outer surface size minus the inner
+		 * content size
+		 */
+		outer = (cairo_rectangle_int_t) {
+			0, 0, component_width, component_height,
+		};
+		hole = (cairo_rectangle_int_t) {
+			-component_x, -component_y,
+			libdecor_frame_get_content_width(&frame_cairo->frame),
+			libdecor_frame_get_content_height(&frame_cairo->frame),
+		};
+		if (rectangle_equal(&outer,
+				    &border_component->server.input_region) &&
+		    rectangle_equal(&hole,
+				    &border_component->server.input_region_hole))
+			return;
 
-	surface_output = zalloc(sizeof *surface_output);
-	surface_output->output = output;
-	wl_list_insert(list, &surface_output->link);
-	return true;
+		input_region = wl_compositor_create_region(
+				       frame_cairo->plugin_cairo->wl_compositor);
+		wl_region_add(input_region,
+			      outer.x, outer.y, outer.width, outer.height);
+		wl_region_subtract(input_region,
+				   hole.x, hole.y, hole.width, hole.height);
+		wl_surface_set_input_region(border_component->server.wl_surface,
+					    input_region);
+		wl_region_destroy(input_region);
+
+		border_component->server.input_region = outer;
+		border_component->server.input_region_hole = hole;
+	}
 }
 
-static void
-surface_enter(void *data,
-	      struct wl_surface *wl_surface,
-	      struct wl_output *wl_output)
+/*
+ * Pick a buffer of the component the compositor has released, before
+ * allocating another one. The alternate title bar rendering is kept.
+ */
+static bool
+ensure_component_realized_server(struct libdecor_frame_cairo *frame_cairo,
+				 struct border_component *border_component,
+				 int component_width,
+				 int component_height,
+				 int scale)
 {
-	struct libdecor_frame_cairo *frame_cairo = data;
-	struct border_component *cmpnt;
+	struct buffer **buffers = border_component->server.buffers;
+	const int buffer_width = component_width * scale;
+	const int buffer_height = component_height * scale;
+	struct buffer *buffer;
+	int slot = -1;
+	unsigned int i;
+
+	buffer = border_component->server.buffer;
+	if (buffer && !buffer->in_use &&
+	    buffer->scale == scale &&
+	    buffer->buffer_width == buffer_width &&
+	    buffer->buffer_height == buffer_height)
+		return true;
 
-	if (!(own_surface(wl_surface) && own_output(wl_output)))
-	    return;
+	for (i = 0; i < ARRAY_LENGTH(border_component->server.buffers); i++) {
+		buffer = buffers[i];
+		if (!buffer) {
+			slot = i;
+			continue;
+		}
+		if (buffer->in_use ||
+		    buffer == border_component->server.alternate_buffer)
+			continue;
+
+		if (is_buffer_capacity_suitable(buffer,
+						buffer_width, buffer_height)) {
+			/* a new wl_buffer, needing full damage when attached */
+			if (buffer == border_component->server.attached_buffer &&
+			    (buffer->buffer_width != buffer_width ||
+			     buffer->buffer_height != buffer_height))
+				border_component->server.attached_buffer = NULL;
+			resize_shm_buffer(buffer,
+					  component_width, component_height,
+					  scale);
+			border_component->server.buffer = buffer;
+			return true;
+		}
 
-	cmpnt = get_component_for_surface(frame_cairo, wl_surface);
-	if (cmpnt == NULL)
-		return;
+		/* released buffers of another capacity are of no further use */
+		free_component_buffer(border_component, i);
+		slot = i;
+	}
 
-	if (!add_surface_output(frame_cairo->plugin_cairo, wl_output,
-				&cmpnt->server.output_list))
-		return;
+	/* all buffers are still held by the compositor, replace one */
+	if (slot < 0) {
+		for (i = 0; i < ARRAY_LENGTH(border_component->server.buffers); i++) {
+			if (buffers[i] != border_component->server.buffer &&
+			    buffers[i] != border_component->server.alternate_buffer) {
+				slot = i;
+				break;
+			}
+		}
+		free_component_buffer(border_component, slot);
+	}
 
-	if (redraw_scale(frame_cairo, cmpnt))
-		libdecor_frame_toplevel_commit(&frame_cairo->frame);
+	buffers[slot] =
+		create_shm_buffer_with_capacity(frame_cairo->plugin_cairo,
+						component_width,
+						component_height,
+						border_component->opaque,
+						scale,
+						get_buffer_capacity(buffer_width),
+						get_buffer_capacity(buffer_height));
+	border_component->server.buffer = buffers[slot];
+
+	return buffers[slot] != NULL;
 }
 
 static bool
-remove_surface_output(struct wl_list *list, struct wl_output *wl_output)
+ensure_component_realized(struct libdecor_frame_cairo *frame_cairo,
+			  struct border_component *border_component,
+			  int component_width,
+			  int component_height,
+			  int scale)
 {
-	struct surface_output *surface_output;
-	wl_list_for_each(surface_output, list, link) {
-		if (surface_output->output->wl_output == wl_output) {
-			wl_list_remove(&surface_output->link);
-			free(surface_output);
-			return true;
-		}
+	switch (border_component->composite_mode) {
+	case COMPOSITE_SERVER:
+		return ensure_component_realized_server(frame_cairo,
+							border_component,
+							component_width,
+							component_height,
+							scale);
+	case COMPOSITE_CLIENT:
+		/* drawn straight into the buffer of the server component */
+		return true;
 	}
+
 	return false;
 }
 
 static void
-surface_leave(void *data,
-	      struct wl_surface *wl_surface,
-	      struct wl_output *wl_output)
+redraw_done(void *user_data,
+	    struct wl_callback *callback,
+	    uint32_t time)
 {
-	struct libdecor_frame_cairo *frame_cairo = data;
-	struct border_component *cmpnt;
+	struct libdecor_frame_cairo *frame_cairo = user_data;
 
-	if (!(own_surface(wl_surface) && own_output(wl_output)))
-	    return;
+	wl_callback_destroy(callback);
+	frame_cairo->redraw_callback = NULL;
+	frame_cairo->redraw_callback_surface = NULL;
 
-	cmpnt = get_component_for_surface(frame_cairo, wl_surface);
-	if (cmpnt == NULL)
-		return;
+	/* redraws scheduled meanwhile waited for this */
+	if (frame_cairo->dirty_components)
+		schedule_flush(frame_cairo->plugin_cairo);
+}
 
-	if (!remove_surface_output(&cmpnt->server.output_list, wl_output))
+static const struct wl_callback_listener redraw_listener = {
+	redraw_done
+};
+
+static void
+request_redraw_callback(struct libdecor_frame_cairo *frame_cairo,
+			struct wl_surface *wl_surface)
+{
+	if (frame_cairo->redraw_callback)
 		return;
 
-	if (redraw_scale(frame_cairo, cmpnt))
-		libdecor_frame_toplevel_commit(&frame_cairo->frame);
+	frame_cairo->redraw_callback_surface = wl_surface;
+	frame_cairo->redraw_callback = wl_surface_frame(wl_surface);
+	wl_callback_add_listener(frame_cairo->redraw_callback,
+				 &redraw_listener,
+				 frame_cairo);
 }
 
-static struct wl_surface_listener surface_listener = {
-	surface_enter,
-	surface_leave,
-};
-
+/*
+ * Set the opaque region of a surface to the given rectangle, or unset it for
+ * an empty one, unless that is the region set last already.
+ */
 static void
-create_surface_subsurface_pair(struct libdecor_frame_cairo *frame_cairo,
-			       struct wl_surface **out_wl_surface,
-			       struct wl_subsurface **out_wl_subsurface)
+update_opaque_region(struct libdecor_frame_cairo *frame_cairo,
+		     struct wl_surface *wl_surface,
+		     cairo_rectangle_int_t *opaque_region,
+		     int x,
+		     int y,
+		     int width,
+		     int height)
 {
-	struct libdecor_plugin_cairo *plugin_cairo = frame_cairo->plugin_cairo;
-	struct libdecor_frame *frame = &frame_cairo->frame;
-	struct wl_compositor *wl_compositor = plugin_cairo->wl_compositor;
-	struct wl_subcompositor *wl_subcompositor = plugin_cairo->wl_subcompositor;
-	struct wl_surface *wl_surface;
-	struct wl_surface *parent;
-	struct wl_subsurface *wl_subsurface;
+	struct wl_region *region = NULL;
 
-	wl_surface = wl_compositor_create_surface(wl_compositor);
-	wl_proxy_set_tag((struct wl_proxy *) wl_surface,
-			 &libdecor_cairo_proxy_tag);
+	if (width <= 0 || height <= 0)
+		x = y = width = height = 0;
 
-	parent = libdecor_frame_get_wl_surface(frame);
-	wl_subsurface = wl_subcompositor_get_subsurface(wl_subcompositor,
-							wl_surface,
-							parent);
+	if (opaque_region->x == x && opaque_region->y == y &&
+	    opaque_region->width == width && opaque_region->height == height)
+		return;
 
-	*out_wl_surface = wl_surface;
-	*out_wl_subsurface = wl_subsurface;
+	if (width > 0) {
+		region = wl_compositor_create_region(
+				frame_cairo->plugin_cairo->wl_compositor);
+		wl_region_add(region, x, y, width, height);
+	}
+	wl_surface_set_opaque_region(wl_surface, region);
+	if (region)
+		wl_region_destroy(region);
+
+	opaque_region->x = x;
+	opaque_region->y = y;
+	opaque_region->width = width;
+	opaque_region->height = height;
 }
 
+/*
+ * Damage what was drawn since the last commit, or all of the buffer when it is
+ * not the one attached already, e.g. the alternate title bar buffer.
+ */
 static void
-ensure_component(struct libdecor_frame_cairo *frame_cairo,
-		 struct border_component *cmpnt)
+damage_server_surface(struct border_component *border_component)
 {
-	switch (cmpnt->composite_mode) {
-	case COMPOSITE_SERVER:
-		if (!cmpnt->server.wl_surface) {
-			wl_list_init(&cmpnt->server.output_list);
-			cmpnt->server.scale = 1;
-			create_surface_subsurface_pair(frame_cairo,
-						       &cmpnt->server.wl_surface,
-						       &cmpnt->server.wl_subsurface);
-			wl_surface_add_listener(cmpnt->server.wl_surface,
-						&surface_listener,
-						frame_cairo);
+	struct wl_surface *wl_surface = border_component->server.wl_surface;
+	struct buffer *buffer = border_component->server.buffer;
+	cairo_region_t *damage = border_component->server.damage;
+	cairo_rectangle_int_t rectangle;
+	int i;
+
+	if (buffer != border_component->server.attached_buffer || !damage) {
+		wl_surface_damage_buffer(wl_surface, 0, 0,
+					 buffer->buffer_width,
+					 buffer->buffer_height);
+	} else {
+		for (i = 0; i < cairo_region_num_rectangles(damage); i++) {
+			cairo_region_get_rectangle(damage, i, &rectangle);
+			wl_surface_damage_buffer(wl_surface,
+						 rectangle.x, rectangle.y,
+						 rectangle.width,
+						 rectangle.height);
 		}
-		break;
-	case COMPOSITE_CLIENT:
-			wl_list_init(&cmpnt->server.output_list);
-		break;
 	}
 
-	cmpnt->is_hidden = false;
+	if (damage) {
+		cairo_region_destroy(damage);
+		border_component->server.damage = NULL;
+	}
+	border_component->server.attached_buffer = buffer;
+}
+
+static void
+commit_server_component(struct libdecor_frame_cairo *frame_cairo,
+			struct border_component *border_component)
+{
+	struct buffer *buffer = border_component->server.buffer;
+	int component_x;
+	int component_y;
+	int component_width;
+	int component_height;
+
+	calculate_component_size(frame_cairo, border_component->type,
+				 &component_x, &component_y,
+				 &component_width, &component_height);
+
+	if (frame_cairo->wants_redraw_callback) {
+		request_redraw_callback(frame_cairo,
+					border_component->server.wl_surface);
+		frame_cairo->wants_redraw_callback = false;
+	}
+
+	wl_surface_attach(border_component->server.wl_surface,
+			  buffer->wl_buffer,
+			  0, 0);
+	wl_surface_set_buffer_scale(border_component->server.wl_surface,
+				    buffer->scale);
+	if (border_component->opaque)
+		update_opaque_region(frame_cairo,
+				     border_component->server.wl_surface,
+				     &border_component->server.opaque_region,
+				     0, 0, component_width, component_height);
+	damage_server_surface(border_component);
+	buffer->in_use = true;
+	wl_surface_commit(border_component->server.wl_surface);
+	wl_subsurface_set_position(border_component->server.wl_subsurface,
+				   component_x, component_y);
 }
 
-static void
-ensure_border_surfaces(struct libdecor_frame_cairo *frame_cairo)
+static bool
+use_shadow_slices(struct libdecor_frame_cairo *frame_cairo,
+		  int component_width,
+		  int component_height)
 {
-	frame_cairo->shadow.opaque = false;
-	ensure_component(frame_cairo, &frame_cairo->shadow);
-
-	libdecor_frame_set_min_content_size(&frame_cairo->frame,
-					    MAX(56, 4 * BUTTON_WIDTH),
-					    MAX(56, TITLE_HEIGHT + 1));
+	return (frame_cairo->plugin_cairo->wp_viewporter &&
+		component_width > 2 * SHADOW_SLICE_CORNER &&
+		component_height > 2 * SHADOW_SLICE_CORNER);
 }
 
 static void
-ensure_title_bar_surfaces(struct libdecor_frame_cairo *frame_cairo)
+ensure_child_surface(struct libdecor_frame_cairo *frame_cairo,
+		     struct border_component *border_component,
+		     struct child_surface *child)
 {
-	frame_cairo->title_bar.title.opaque = true;
-	ensure_component(frame_cairo, &frame_cairo->title_bar.title);
-
-	frame_cairo->title_bar.min.opaque = true;
-	ensure_component(frame_cairo, &frame_cairo->title_bar.min);
+	struct libdecor_plugin_cairo *plugin_cairo = frame_cairo->plugin_cairo;
+	struct wl_region *empty_region;
 
-	frame_cairo->title_bar.max.opaque = true;
-	ensure_component(frame_cairo, &frame_cairo->title_bar.max);
+	if (child->wl_surface)
+		return;
 
-	frame_cairo->title_bar.close.opaque = true;
-	ensure_component(frame_cairo, &frame_cairo->title_bar.close);
+	child->wl_surface =
+		wl_compositor_create_surface(plugin_cairo->wl_compositor);
+	wl_proxy_set_tag((struct wl_proxy *) child->wl_surface,
+			 &libdecor_cairo_proxy_tag);
+	child->wl_subsurface =
+		wl_subcompositor_get_subsurface(plugin_cairo->wl_subcompositor,
+						child->wl_surface,
+						border_component->server.wl_surface);
+	child->wp_viewport =
+		wp_viewporter_get_viewport(plugin_cairo->wp_viewporter,
+					   child->wl_surface);
+
+	empty_region = wl_compositor_create_region(plugin_cairo->wl_compositor);
+	wl_surface_set_input_region(child->wl_surface, empty_region);
+	wl_region_destroy(empty_region);
 }
 
 static void
-calculate_component_size(struct libdecor_frame_cairo *frame_cairo,
-			 enum component component,
-			 int *component_x,
-			 int *component_y,
-			 int *component_width,
-			 int *component_height)
+ensure_component_viewport(struct libdecor_frame_cairo *frame_cairo,
+			  struct border_component *border_component)
 {
-	struct libdecor_frame *frame = &frame_cairo->frame;
-	int content_width, content_height;
+	if (!border_component->server.wp_viewport)
+		border_component->server.wp_viewport =
+			wp_viewporter_get_viewport(
+				frame_cairo->plugin_cairo->wp_viewporter,
+				border_component->server.wl_surface);
+}
 
-	content_width = libdecor_frame_get_content_width(frame);
-	content_height = libdecor_frame_get_content_height(frame);
+static void
+hide_shadow_slices(struct libdecor_frame_cairo *frame_cairo)
+{
+	struct border_component *shadow = &frame_cairo->shadow;
+	int i;
 
-	switch (component) {
-	case NONE:
-		*component_width = 0;
-		*component_height = 0;
-		return;
-	case SHADOW:
-		*component_x = -(int)SHADOW_MARGIN;
-		*component_y = -(int)(SHADOW_MARGIN+TITLE_HEIGHT);
-		*component_width = content_width + 2 * SHADOW_MARGIN;
-		*component_height = content_height
-				    + 2 * SHADOW_MARGIN
-				    + TITLE_HEIGHT;
-		return;
-	case TITLE:
-		*component_x = 0;
-		*component_y = -(int)TITLE_HEIGHT;
-		*component_width = content_width;
-		*component_height = TITLE_HEIGHT;
-		return;
-	case BUTTON_MIN:
-		*component_x = content_width - 3 * BUTTON_WIDTH;
-		*component_y = 0;
-		*component_width = BUTTON_WIDTH;
-		*component_height = TITLE_HEIGHT;
-		return;
-	case BUTTON_MAX:
-		*component_x = content_width - 2 * BUTTON_WIDTH;
-		*component_y = 0;
-		*component_width = BUTTON_WIDTH;
-		*component_height = TITLE_HEIGHT;
-		return;
-	case BUTTON_CLOSE:
-		*component_x = content_width - BUTTON_WIDTH;
-		*component_y = 0;
-		*component_width = BUTTON_WIDTH;
-		*component_height = TITLE_HEIGHT;
+	if (!frame_cairo->shadow_slices_scale)
 		return;
+
+	for (i = 0; i < SHADOW_SLICE_COUNT; i++) {
+		wl_surface_attach(frame_cairo->shadow_slices[i].wl_surface,
+				  NULL, 0, 0);
+		wl_surface_commit(frame_cairo->shadow_slices[i].wl_surface);
 	}
+	frame_cairo->shadow_slices_scale = 0;
 
-	abort();
+	if (shadow->server.wp_viewport)
+		wp_viewport_set_destination(shadow->server.wp_viewport, -1, -1);
 }
 
-static int
-border_component_get_scale(struct border_component *border_component)
+/*
+ * Source rectangle in the nine-slice image, and position and size in the
+ * shadow surface, of one slice of a shadow surface of the given size.
+ */
+static void
+calculate_shadow_slice(enum shadow_slice_position position,
+		       int width,
+		       int height,
+		       int *src_x, int *src_y, int *src_width, int *src_height,
+		       int *x, int *y, int *dst_width, int *dst_height)
 {
-	switch (border_component->composite_mode) {
-	case COMPOSITE_SERVER:
-		return border_component->server.scale;
-	case COMPOSITE_CLIENT:
-		return border_component_get_scale(
-				border_component->client.parent_component);
+	const int corner = SHADOW_SLICE_CORNER;
+	const int far = corner + SHADOW_SLICE_STRETCH;
+	/* stay clear of the corners to not sample them when filtering */
+	const int stretch_start = corner + SHADOW_SLICE_STRETCH / 4;
+	const int stretch_size = SHADOW_SLICE_STRETCH / 2;
+
+	switch (position) {
+	case SHADOW_SLICE_TOP_LEFT:
+	case SHADOW_SLICE_LEFT:
+	case SHADOW_SLICE_BOTTOM_LEFT:
+		*src_x = 0;
+		*src_width = corner;
+		*x = 0;
+		*dst_width = corner;
+		break;
+	case SHADOW_SLICE_TOP:
+	case SHADOW_SLICE_BOTTOM:
+		*src_x = stretch_start;
+		*src_width = stretch_size;
+		*x = corner;
+		*dst_width = width - 2 * corner;
+		break;
+	default:
+		*src_x = far;
+		*src_width = corner;
+		*x = width - corner;
+		*dst_width = corner;
+		break;
+	}
+
+	switch (position) {
+	case SHADOW_SLICE_TOP_LEFT:
+	case SHADOW_SLICE_TOP:
+	case SHADOW_SLICE_TOP_RIGHT:
+		*src_y = 0;
+		*src_height = corner;
+		*y = 0;
+		*dst_height = corner;
+		break;
+	case SHADOW_SLICE_LEFT:
+	case SHADOW_SLICE_RIGHT:
+		*src_y = stretch_start;
+		*src_height = stretch_size;
+		*y = corner;
+		*dst_height = height - 2 * corner;
+		break;
+	default:
+		*src_y = far;
+		*src_height = corner;
+		*y = height - corner;
+		*dst_height = corner;
+		break;
 	}
-	return 0;
 }
 
-static void
-draw_title_text(struct libdecor_frame_cairo *frame_cairo,
-		cairo_t *cr,
-		const int *title_width,
-		bool active)
+/*
+ * Show the shadow as nine-slice subsurfaces on top of an invisible shadow
+ * surface, which only provides the input region. Resizing only updates the
+ * slice positions and viewports, without any new buffer or drawing.
+ */
+static bool
+draw_shadow_slices(struct libdecor_frame_cairo *frame_cairo,
+		   int component_x,
+		   int component_y,
+		   int component_width,
+		   int component_height)
 {
-	const uint32_t col_title = active ? COL_TITLE : COL_TITLE_INACT;
-	const uint32_t col_title_text = active ? COL_SYM : COL_SYM_INACT;
-
-	PangoLayout *layout;
-
-	/* title fade out at buttons */
-	const int fade_width = 5 * BUTTON_WIDTH;
-	int fade_start;
-	cairo_pattern_t *fade;
-
-	/* text position and dimensions */
-	int text_extents_width, text_extents_height;
-	double text_x, text_y;
-	double text_width, text_height;
-
-	const char *title;
-
-	title = libdecor_frame_get_title((struct libdecor_frame*) frame_cairo);
-	if (!title)
-		return;
+	struct libdecor_plugin_cairo *plugin_cairo = frame_cairo->plugin_cairo;
+	struct border_component *shadow = &frame_cairo->shadow;
+	struct buffer *slice_buffer;
+	struct buffer *transparent_buffer;
+	struct child_surface *slice;
+	int scale = shadow->server.scale;
+	int src_x, src_y, src_width, src_height;
+	int x, y, width, height;
+	int i;
+
+	slice_buffer = get_shadow_slice_buffer(plugin_cairo, scale);
+	transparent_buffer = get_solid_buffer(plugin_cairo, 0x00000000);
+	if (!slice_buffer || !transparent_buffer)
+		return false;
 
-	layout = pango_cairo_create_layout(cr);
+	for (i = 0; i < SHADOW_SLICE_COUNT; i++) {
+		slice = &frame_cairo->shadow_slices[i];
+		ensure_child_surface(frame_cairo, shadow, slice);
+
+		calculate_shadow_slice(i, component_width, component_height,
+				       &src_x, &src_y, &src_width, &src_height,
+				       &x, &y, &width, &height);
+
+		if (frame_cairo->shadow_slices_scale != scale) {
+			wl_surface_attach(slice->wl_surface,
+					  slice_buffer->wl_buffer, 0, 0);
+			wl_surface_set_buffer_scale(slice->wl_surface, scale);
+			wl_surface_damage_buffer(slice->wl_surface, 0, 0,
+						 slice_buffer->buffer_width,
+						 slice_buffer->buffer_height);
+		}
+		wp_viewport_set_source(slice->wp_viewport,
+				       wl_fixed_from_int(src_x),
+				       wl_fixed_from_int(src_y),
+				       wl_fixed_from_int(src_width),
+				       wl_fixed_from_int(src_height));
+		wp_viewport_set_destination(slice->wp_viewport, width, height);
+		wl_subsurface_set_position(slice->wl_subsurface, x, y);
+		wl_surface_commit(slice->wl_surface);
+	}
+	frame_cairo->shadow_slices_scale = scale;
 
-	pango_layout_set_text(layout,
-			      title,
-			      -1);
-	pango_layout_set_font_description(layout, frame_cairo->plugin_cairo->font);
-	pango_layout_get_size(layout, &text_extents_width, &text_extents_height);
+	/* a full size shadow buffer from before is no longer needed */
+	free_component_buffers(shadow);
 
-	/* set text position and dimensions */
-	text_width = text_extents_width / PANGO_SCALE;
-	text_height = text_extents_height / PANGO_SCALE;
-	text_x = *title_width / 2.0 - text_width / 2.0;
-	text_x += MIN(0.0, ((*title_width - fade_width) - (text_x + text_width)));
-	text_x = MAX(text_x, BUTTON_WIDTH);
-	text_y = TITLE_HEIGHT / 2.0 - text_height / 2.0;
+	ensure_component_viewport(frame_cairo, shadow);
 
-	/* draw title text */
-	cairo_move_to(cr, text_x, text_y);
-	cairo_set_rgba32(cr, &col_title_text);
-	pango_cairo_show_layout(cr, layout);
+	if (frame_cairo->wants_redraw_callback) {
+		request_redraw_callback(frame_cairo, shadow->server.wl_surface);
+		frame_cairo->wants_redraw_callback = false;
+	}
 
-	/* draw fade-out from title text to buttons */
-	fade_start = *title_width - fade_width;
-	fade = cairo_pattern_create_linear(fade_start, 0,
-					   fade_start + 2 * BUTTON_WIDTH, 0);
-	cairo_pattern_add_color_stop_rgba(fade, 0,
-					  red(&col_title),
-					  green(&col_title),
-					  blue(&col_title),
-					  0);
-	cairo_pattern_add_color_stop_rgb(fade, 1,
-					 red(&col_title),
-					 green(&col_title),
-					 blue(&col_title));
-	cairo_rectangle(cr, fade_start, 0, fade_width, TITLE_HEIGHT);
-	cairo_set_source(cr, fade);
-	cairo_fill(cr);
+	wl_surface_attach(shadow->server.wl_surface,
+			  transparent_buffer->wl_buffer, 0, 0);
+	wl_surface_set_buffer_scale(shadow->server.wl_surface, 1);
+	wp_viewport_set_destination(shadow->server.wp_viewport,
+				    component_width, component_height);
+	wl_surface_damage_buffer(shadow->server.wl_surface, 0, 0, 1, 1);
+	wl_surface_commit(shadow->server.wl_surface);
+	wl_subsurface_set_position(shadow->server.wl_subsurface,
+				   component_x, component_y);
 
-	cairo_pattern_destroy(fade);
-	g_object_unref(layout);
+	return true;
 }
 
-static void
-draw_component_content(struct libdecor_frame_cairo *frame_cairo,
-		       struct border_component *border_component,
-		       int component_width,
-		       int component_height,
-		       enum component component)
+/*
+ * Title text as a buffer, rasterized once per title, scale and activation
+ * state like the title image.
+ */
+static struct buffer *
+ensure_title_text_buffer(struct libdecor_frame_cairo *frame_cairo,
+			 int scale,
+			 bool active)
 {
 	struct buffer *buffer;
-	cairo_surface_t *surface = NULL;
-	int width = 0, height = 0;
-	int scale;
+	cairo_surface_t *scratch;
+	cairo_surface_t *image;
 	cairo_t *cr;
+	const char *title;
 
-	/* button symbol origin */
-	const double x = BUTTON_WIDTH / 2 - SYM_DIM / 2 + 0.5;
-	const double y = TITLE_HEIGHT / 2 - SYM_DIM / 2 + 0.5;
-
-	enum libdecor_window_state state;
-
-	bool active;
+	title = libdecor_frame_get_title((struct libdecor_frame*) frame_cairo);
+	if (!title)
+		return NULL;
 
-	uint32_t col_title;
+	buffer = frame_cairo->title_layout.buffers[active];
+	if (buffer && buffer->scale == scale)
+		return buffer;
 
-	bool cap_min, cap_max, cap_close;
+	/* only for the font options and device scale to lay out the title */
+	scratch = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 1, 1);
+	cairo_surface_set_device_scale(scratch, scale, scale);
+	cr = cairo_create(scratch);
+	image = ensure_title_image(frame_cairo, cr, title, scale, active);
+	cairo_destroy(cr);
+	cairo_surface_destroy(scratch);
+	if (!image)
+		return NULL;
 
-	/* capabilities of decorations */
-	cap_min = minimizable(frame_cairo);
-	cap_max = resizable(frame_cairo);
-	cap_close = closeable(frame_cairo);
+	buffer = create_shm_buffer(frame_cairo->plugin_cairo,
+				   frame_cairo->title_layout.ink_rect.width,
+				   frame_cairo->title_layout.ink_rect.height,
+				   false,
+				   scale);
+	if (!buffer)
+		return NULL;
 
-	scale = border_component_get_scale(border_component);
+	cr = cairo_create(get_buffer_surface(buffer));
+	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+	cairo_set_source_surface(cr, image, 0, 0);
+	cairo_paint(cr);
+	cairo_destroy(cr);
 
-	state = libdecor_frame_get_window_state((struct libdecor_frame *) frame_cairo);
+	frame_cairo->title_layout.buffers[active] = buffer;
 
-	active = state & LIBDECOR_WINDOW_STATE_ACTIVE;
+	return buffer;
+}
 
-	col_title = active ? COL_TITLE : COL_TITLE_INACT;
+static uint32_t
+get_title_cluster_key(struct libdecor_frame_cairo *frame_cairo,
+		      bool active)
+{
+	static const enum component buttons[] = {
+		BUTTON_MIN, BUTTON_MAX, BUTTON_CLOSE,
+	};
+	enum button_glyph glyph;
+	enum button_state state;
+	uint32_t key;
+	unsigned int i;
+
+	key = active;
+	for (i = 0; i < ARRAY_LENGTH(buttons); i++) {
+		get_button_sprite(frame_cairo, buttons[i], &glyph, &state);
+		key |= (glyph * BUTTON_STATE_COUNT + state) << (1 + 5 * i);
+	}
 
-	/* clear buffer */
-	switch (border_component->composite_mode) {
-	case COMPOSITE_SERVER:
-		buffer = border_component->server.buffer;
+	return key;
+}
 
-		surface = cairo_image_surface_create_for_data(
-				  buffer->data, CAIRO_FORMAT_ARGB32,
-				  buffer->buffer_width, buffer->buffer_height,
-				  cairo_format_stride_for_width(
-					  CAIRO_FORMAT_ARGB32,
-					  buffer->buffer_width)
-				  );
-		cairo_surface_set_device_scale(surface, scale, scale);
-		width = buffer->width;
-		height = buffer->height;
-		break;
-	case COMPOSITE_CLIENT:
-		surface = cairo_surface_reference(border_component->client.image);
-		width = cairo_image_surface_get_width(surface);
-		height = cairo_image_surface_get_height(surface);
-		break;
-	}
+/*
+ * Fade-out and buttons at the right end of the title bar. Repainted only
+ * when a button or the activation state changes, alternating between two
+ * buffers to not paint into one the compositor may still read from.
+ */
+static struct buffer *
+ensure_title_cluster_buffer(struct libdecor_frame_cairo *frame_cairo,
+			    int scale,
+			    bool active)
+{
+	const uint32_t col_title = active ? COL_TITLE : COL_TITLE_INACT;
+	const int cluster_width = 5 * BUTTON_WIDTH;
+	struct buffer *buffer = frame_cairo->title_bar.cluster_buffer;
+	cairo_pattern_t *fade;
+	cairo_t *cr;
+	uint32_t key;
+	int slot;
 
-	cr = cairo_create(surface);
-	cairo_save(cr);
-	cairo_set_source_rgba(cr, 0.0, 0.0, 0.0, 0.0);
-	cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
-	cairo_paint(cr);
-	cairo_restore(cr);
+	key = get_title_cluster_key(frame_cairo, active);
+	if (buffer && buffer->scale == scale &&
+	    frame_cairo->title_bar.cluster_key == key)
+		return buffer;
 
-	/* background */
-	switch (component) {
-	case NONE:
-		break;
-	case SHADOW:
-		render_shadow(cr,
-			      frame_cairo->shadow_blur,
-			      -(int)SHADOW_MARGIN/2,
-			      -(int)SHADOW_MARGIN/2,
-			      width + SHADOW_MARGIN,
-			      height + SHADOW_MARGIN,
-			      64,
-			      64);
-		break;
-	case TITLE:
-		cairo_set_rgba32(cr, &col_title);
-		cairo_paint(cr);
-		break;
-	case BUTTON_MIN:
-		if (cap_min && frame_cairo->active == &frame_cairo->title_bar.min)
-			cairo_set_rgba32(cr, active ? &COL_BUTTON_MIN : &COL_BUTTON_INACT);
-		else
-			cairo_set_rgba32(cr, &col_title);
-		cairo_paint(cr);
-		break;
-	case BUTTON_MAX:
-		if (cap_max && frame_cairo->active == &frame_cairo->title_bar.max)
-			cairo_set_rgba32(cr, active ? &COL_BUTTON_MAX : &COL_BUTTON_INACT);
-		else
-			cairo_set_rgba32(cr, &col_title);
-		cairo_paint(cr);
-		break;
-	case BUTTON_CLOSE:
-		if (cap_close && frame_cairo->active == &frame_cairo->title_bar.close)
-			cairo_set_rgba32(cr, active ? &COL_BUTTON_CLOSE : &COL_BUTTON_INACT);
-		else
-			cairo_set_rgba32(cr, &col_title);
-		cairo_paint(cr);
-		break;
+	slot = frame_cairo->title_bar.cluster_buffers[0] == buffer ? 1 : 0;
+	buffer = frame_cairo->title_bar.cluster_buffers[slot];
+	if (buffer && (buffer->in_use || buffer->scale != scale)) {
+		buffer_free(buffer);
+		buffer = NULL;
 	}
+	if (!buffer)
+		buffer = create_shm_buffer(frame_cairo->plugin_cairo,
+					   cluster_width, TITLE_HEIGHT,
+					   false, scale);
+	frame_cairo->title_bar.cluster_buffers[slot] = buffer;
+	if (!buffer)
+		return NULL;
 
-	/* button symbols */
-	/* https://www.cairographics.org/FAQ/#sharp_lines */
-	cairo_set_line_width(cr, 1);
-
-	switch (component) {
-	case TITLE:
-		draw_title_text(frame_cairo,cr, &component_width, active);
-		break;
-	case BUTTON_MIN:
-		if (!active) {
-			/* inactive: use single desaturated color */
-			cairo_set_rgba32(cr, &COL_SYM_INACT);
-		} else {
-			if (!cap_min ||
-			    frame_cairo->active == &frame_cairo->title_bar.min) {
-				/* active (a.k.a. prelight) */
-				cairo_set_rgba32(cr, &COL_SYM_ACT);
-			} else {
-				/* normal */
-				cairo_set_rgba32(cr, &COL_SYM);
-			}
-		}
-		cairo_move_to(cr, x, y + SYM_DIM - 1);
-		cairo_rel_line_to(cr, SYM_DIM - 1, 0);
-		cairo_stroke(cr);
-		break;
-	case BUTTON_MAX:
-		if (!active) {
-			/* inactive: use single desaturated color */
-			cairo_set_rgba32(cr, &COL_SYM_INACT);
-		} else {
-			if (!cap_max ||
-			    frame_cairo->active == &frame_cairo->title_bar.max) {
-				/* active (a.k.a. prelight) */
-				cairo_set_rgba32(cr, &COL_SYM_ACT);
-			} else {
-				/* normal */
-				cairo_set_rgba32(cr, &COL_SYM);
-			}
-		}
+	cr = cairo_create(get_buffer_surface(buffer));
 
-		if (state & LIBDECOR_WINDOW_STATE_MAXIMIZED) {
-			const size_t small = 12;
-			cairo_rectangle(cr,
-					x,
-					y + SYM_DIM - small,
-					small - 1,
-					small - 1);
-			cairo_move_to(cr,
-				      x + SYM_DIM - small,
-				      y + SYM_DIM - small);
-			cairo_line_to(cr, x + SYM_DIM - small, y);
-			cairo_rel_line_to(cr, small - 1, 0);
-			cairo_rel_line_to(cr, 0, small - 1);
-			cairo_line_to(cr, x + small - 1, y + small - 1);
-		}
-		else {
-			cairo_rectangle(cr, x, y, SYM_DIM - 1, SYM_DIM - 1);
-		}
-		cairo_stroke(cr);
-		break;
-	case BUTTON_CLOSE:
-		if (!active) {
-			/* inactive: use single desaturated color */
-			cairo_set_rgba32(cr, &COL_SYM_INACT);
-		} else {
-			if (!cap_close ||
-			    frame_cairo->active == &frame_cairo->title_bar.close) {
-				/* active (a.k.a. prelight) */
-				cairo_set_rgba32(cr, &COL_SYM_ACT);
-			} else {
-				/* normal */
-				cairo_set_rgba32(cr, &COL_SYM);
-			}
-		}
-		cairo_move_to(cr, x, y);
-		cairo_rel_line_to(cr, SYM_DIM - 1, SYM_DIM - 1);
-		cairo_move_to(cr, x + SYM_DIM - 1, y);
-		cairo_line_to(cr, x, y + SYM_DIM - 1);
-		cairo_stroke(cr);
-		break;
-	default:
-		break;
-	}
+	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+	fade = create_title_fade(col_title, 0);
+	cairo_set_source(cr, fade);
+	cairo_paint(cr);
+	cairo_pattern_destroy(fade);
 
-	/* mask the toplevel surface */
-	if (component == SHADOW) {
-		int component_x, component_y, component_width, component_height;
-		calculate_component_size(frame_cairo, component,
-					 &component_x, &component_y,
-					 &component_width, &component_height);
-		cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
-		cairo_rectangle(cr, -component_x, -component_y,
-				libdecor_frame_get_content_width(
-					&frame_cairo->frame),
-				libdecor_frame_get_content_height(
-					&frame_cairo->frame));
-		cairo_fill(cr);
-	}
+	cairo_translate(cr, 2 * BUTTON_WIDTH, 0);
+	draw_button(frame_cairo, cr, BUTTON_MIN, scale);
+	cairo_translate(cr, BUTTON_WIDTH, 0);
+	draw_button(frame_cairo, cr, BUTTON_MAX, scale);
+	cairo_translate(cr, BUTTON_WIDTH, 0);
+	draw_button(frame_cairo, cr, BUTTON_CLOSE, scale);
 
 	cairo_destroy(cr);
-	cairo_surface_destroy(surface);
-}
-
-static void
-set_component_input_region(struct libdecor_frame_cairo *frame_cairo,
-			   struct border_component *border_component)
-{
-	if (border_component->type == SHADOW && frame_cairo->shadow_showing) {
-		struct wl_region *input_region;
-		int component_x;
-		int component_y;
-		int component_width;
-		int component_height;
 
-		calculate_component_size(frame_cairo, border_component->type,
-					 &component_x, &component_y,
-					 &component_width, &component_height);
+	frame_cairo->title_bar.cluster_key = key;
 
-		/*
-		 * the input region is the outer surface size minus the inner
-		 * content size
-		 */
-		input_region = wl_compositor_create_region(
-				       frame_cairo->plugin_cairo->wl_compositor);
-		wl_region_add(input_region, 0, 0,
-			      component_width, component_height);
-		wl_region_subtract(input_region, -component_x, -component_y,
-			libdecor_frame_get_content_width(&frame_cairo->frame),
-			libdecor_frame_get_content_height(&frame_cairo->frame));
-		wl_surface_set_input_region(border_component->server.wl_surface,
-					    input_region);
-		wl_region_destroy(input_region);
-	}
+	return buffer;
 }
 
 static void
-ensure_component_realized_server(struct libdecor_frame_cairo *frame_cairo,
-				 struct border_component *border_component,
-				 int component_width,
-				 int component_height,
-				 int scale)
+draw_title_text_part(struct libdecor_frame_cairo *frame_cairo,
+		     int title_width,
+		     int scale,
+		     bool active)
 {
-	struct buffer *old_buffer;
-	struct buffer *buffer = NULL;
+	struct child_surface *text = &frame_cairo->title_bar.text;
+	const PangoRectangle *ink_rect = NULL;
+	struct buffer *buffer;
+	double text_x, text_y;
+	int x = 0, y = 0, visible_width;
+
+	ensure_child_surface(frame_cairo, &frame_cairo->title_bar.title, text);
+
+	buffer = ensure_title_text_buffer(frame_cairo, scale, active);
+	visible_width = 0;
+	if (buffer) {
+		ink_rect = &frame_cairo->title_layout.ink_rect;
+		calculate_title_text_position(frame_cairo, title_width,
+					      &text_x, &text_y);
+		x = (int) round(text_x + ink_rect->x);
+		y = (int) round(text_y + ink_rect->y);
+		/* the text never reaches into the buttons */
+		visible_width = MIN(ink_rect->width,
+				    title_width - 3 * (int) BUTTON_WIDTH - x);
+	}
 
-	old_buffer = border_component->server.buffer;
-	if (old_buffer) {
-		if (!old_buffer->in_use &&
-		    old_buffer->buffer_width == component_width * scale &&
-		    old_buffer->buffer_height == component_height * scale) {
-			buffer = old_buffer;
-		} else {
-			buffer_free(old_buffer);
-			border_component->server.buffer = NULL;
+	if (visible_width <= 0) {
+		if (frame_cairo->title_bar.is_text_showing) {
+			wl_surface_attach(text->wl_surface, NULL, 0, 0);
+			wl_surface_commit(text->wl_surface);
+			frame_cairo->title_bar.text_buffer = NULL;
+			frame_cairo->title_bar.is_text_showing = false;
 		}
+		return;
 	}
 
-	if (!buffer)
-		buffer = create_shm_buffer(frame_cairo->plugin_cairo,
-					   component_width,
-					   component_height,
-					   border_component->opaque,
-					   border_component->server.scale);
+	if (frame_cairo->title_bar.text_buffer != buffer) {
+		wl_surface_attach(text->wl_surface, buffer->wl_buffer, 0, 0);
+		wl_surface_set_buffer_scale(text->wl_surface, buffer->scale);
+		wl_surface_damage_buffer(text->wl_surface, 0, 0,
+					 buffer->buffer_width,
+					 buffer->buffer_height);
+		buffer->in_use = true;
+		frame_cairo->title_bar.text_buffer = buffer;
+		frame_cairo->title_bar.is_text_showing = true;
+	}
 
-	border_component->server.buffer = buffer;
+	if (visible_width < ink_rect->width) {
+		wp_viewport_set_source(text->wp_viewport,
+				       wl_fixed_from_int(0),
+				       wl_fixed_from_int(0),
+				       wl_fixed_from_int(visible_width),
+				       wl_fixed_from_int(ink_rect->height));
+		wp_viewport_set_destination(text->wp_viewport,
+					    visible_width, ink_rect->height);
+	} else {
+		wp_viewport_set_source(text->wp_viewport,
+				       wl_fixed_from_int(-1),
+				       wl_fixed_from_int(-1),
+				       wl_fixed_from_int(-1),
+				       wl_fixed_from_int(-1));
+		wp_viewport_set_destination(text->wp_viewport, -1, -1);
+	}
+	wl_subsurface_set_position(text->wl_subsurface, x, y);
+	wl_surface_commit(text->wl_surface);
 }
 
 static void
-ensure_component_realized_client(struct libdecor_frame_cairo *frame_cairo,
-				 struct border_component *border_component,
-				 int component_width,
-				 int component_height,
-				 int scale)
+draw_title_cluster_part(struct libdecor_frame_cairo *frame_cairo,
+			struct buffer *buffer,
+			int title_width)
 {
-	cairo_surface_t *old_image;
-
-	old_image = border_component->client.image;
-	if (old_image) {
-		int cairo_buffer_width;
-		int cairo_buffer_height;
-		double x_scale;
-		double y_scale;
-
-		cairo_surface_get_device_scale(old_image, &x_scale, &y_scale);
-		cairo_buffer_width =
-			(int) round(cairo_image_surface_get_width(old_image) *
-				    x_scale);
-		cairo_buffer_height =
-			(int) round(cairo_image_surface_get_height(old_image) *
-				    y_scale);
-
-		if (cairo_buffer_width != component_width * scale ||
-		    cairo_buffer_height != component_height * scale) {
-			cairo_surface_destroy(old_image);
-			border_component->client.image = NULL;
-		}
+	struct child_surface *cluster = &frame_cairo->title_bar.cluster;
+	const int cluster_width = 5 * BUTTON_WIDTH;
+	/* the fade-out is opaque after its first two button widths */
+	int opaque_x = 2 * BUTTON_WIDTH;
+	int x;
+
+	ensure_child_surface(frame_cairo, &frame_cairo->title_bar.title,
+			     cluster);
+
+	if (frame_cairo->title_bar.cluster_buffer != buffer) {
+		wl_surface_attach(cluster->wl_surface, buffer->wl_buffer, 0, 0);
+		wl_surface_set_buffer_scale(cluster->wl_surface, buffer->scale);
+		wl_surface_damage_buffer(cluster->wl_surface, 0, 0,
+					 buffer->buffer_width,
+					 buffer->buffer_height);
+		buffer->in_use = true;
+		frame_cairo->title_bar.cluster_buffer = buffer;
 	}
 
-	if (!border_component->client.image) {
-		cairo_surface_t *new_image;
-
-		new_image =
-			cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
-						   component_width * scale,
-						   component_height * scale);
-		cairo_surface_set_device_scale(new_image, scale, scale);
-		border_component->client.image = new_image;
+	/* keep the right end, i.e. the buttons, of too narrow title bars */
+	x = title_width - cluster_width;
+	if (x < 0) {
+		wp_viewport_set_source(cluster->wp_viewport,
+				       wl_fixed_from_int(-x),
+				       wl_fixed_from_int(0),
+				       wl_fixed_from_int(title_width),
+				       wl_fixed_from_int(TITLE_HEIGHT));
+		wp_viewport_set_destination(cluster->wp_viewport,
+					    title_width, TITLE_HEIGHT);
+		opaque_x = MAX(0, opaque_x + x);
+		x = 0;
+	} else {
+		wp_viewport_set_source(cluster->wp_viewport,
+				       wl_fixed_from_int(-1),
+				       wl_fixed_from_int(-1),
+				       wl_fixed_from_int(-1),
+				       wl_fixed_from_int(-1));
+		wp_viewport_set_destination(cluster->wp_viewport, -1, -1);
 	}
-
+	update_opaque_region(frame_cairo, cluster->wl_surface,
+			     &cluster->opaque_region,
+			     opaque_x, 0,
+			     MIN(title_width, cluster_width) - opaque_x,
+			     TITLE_HEIGHT);
+	wl_subsurface_set_position(cluster->wl_subsurface, x, 0);
+	wl_surface_commit(cluster->wl_surface);
 }
 
+/*
+ * Show the title bar as a solid background stretched to the title bar width,
+ * with the title text and the button cluster as fixed size subsurfaces on
+ * top. Resizing only moves the parts, without repainting any of them.
+ */
 static void
-ensure_component_realized(struct libdecor_frame_cairo *frame_cairo,
-			  struct border_component *border_component,
-			  int component_width,
-			  int component_height,
-			  int scale)
+draw_title_bar_parts(struct libdecor_frame_cairo *frame_cairo,
+		     int component_x,
+		     int component_y,
+		     int component_width)
 {
-	switch (border_component->composite_mode) {
-	case COMPOSITE_SERVER:
-		ensure_component_realized_server(frame_cairo, border_component,
-						 component_width,
-						 component_height,
-						 scale);
-		break;
-	case COMPOSITE_CLIENT:
-		ensure_component_realized_client(frame_cairo, border_component,
-						 component_width,
-						 component_height,
-						 scale);
-		break;
+	struct border_component *title = &frame_cairo->title_bar.title;
+	struct buffer *background;
+	struct buffer *cluster_buffer;
+	enum libdecor_window_state window_state;
+	bool active;
+	int scale;
+
+	window_state = libdecor_frame_get_window_state(&frame_cairo->frame);
+	active = window_state & LIBDECOR_WINDOW_STATE_ACTIVE;
+	scale = border_component_get_scale(title);
+
+	background = get_solid_buffer(frame_cairo->plugin_cairo,
+				      active ? COL_TITLE : COL_TITLE_INACT);
+	cluster_buffer = ensure_title_cluster_buffer(frame_cairo, scale, active);
+	if (!background || !cluster_buffer)
+		return;
+
+	/* full title bar buffers from before are no longer needed */
+	free_component_buffers(title);
+
+	ensure_component_viewport(frame_cairo, title);
+
+	if (component_width <= 0) {
+		wl_surface_attach(title->server.wl_surface, NULL, 0, 0);
+		wl_surface_commit(title->server.wl_surface);
+		return;
 	}
-}
 
-static cairo_t *
-create_cairo_for_parent(struct border_component *border_component)
-{
-	struct border_component *parent =
-		border_component->client.parent_component;
-	struct buffer *buffer;
-	struct border_component *server_component;
-	cairo_surface_t *parent_surface;
-	cairo_t *cr;
+	draw_title_text_part(frame_cairo, component_width, scale, active);
+	draw_title_cluster_part(frame_cairo, cluster_buffer, component_width);
 
-	switch (parent->composite_mode) {
-	case COMPOSITE_SERVER:
-		buffer = parent->server.buffer;
-		parent_surface = cairo_image_surface_create_for_data(
-				  buffer->data, CAIRO_FORMAT_ARGB32,
-				  buffer->buffer_width, buffer->buffer_height,
-				  cairo_format_stride_for_width(
-					  CAIRO_FORMAT_ARGB32,
-					  buffer->buffer_width)
-				  );
-		cr = cairo_create(parent_surface);
-		cairo_surface_destroy(parent_surface);
-		cairo_scale(cr, buffer->scale, buffer->scale);
-		return cr;
-	case COMPOSITE_CLIENT:
-		cr = cairo_create(parent->client.image);
-		server_component = get_server_component(border_component);
-		cairo_scale(cr,
-			    server_component->server.scale,
-			    server_component->server.scale);
-		return cr;
+	if (frame_cairo->wants_redraw_callback) {
+		request_redraw_callback(frame_cairo, title->server.wl_surface);
+		frame_cairo->wants_redraw_callback = false;
 	}
-	return NULL;
+
+	wl_surface_attach(title->server.wl_surface, background->wl_buffer, 0, 0);
+	wl_surface_set_buffer_scale(title->server.wl_surface, 1);
+	wp_viewport_set_destination(title->server.wp_viewport,
+				    component_width, TITLE_HEIGHT);
+	update_opaque_region(frame_cairo, title->server.wl_surface,
+			     &title->server.opaque_region,
+			     0, 0, component_width, TITLE_HEIGHT);
+	wl_surface_damage_buffer(title->server.wl_surface, 0, 0, 1, 1);
+	wl_surface_commit(title->server.wl_surface);
+	wl_subsurface_set_position(title->server.wl_subsurface,
+				   component_x, component_y);
 }
 
 static void
@@ -1566,8 +3753,6 @@ draw_border_component(struct libdecor_frame_cairo *frame_cairo,
 		      struct border_component *border_component)
 {
 	enum component component = border_component->type;
-	struct buffer *buffer;
-	cairo_t *cr;
 	int component_x;
 	int component_y;
 	int component_width;
@@ -1578,58 +3763,256 @@ draw_border_component(struct libdecor_frame_cairo *frame_cairo,
 	if (border_component->is_hidden)
 		return;
 
+	if (component != SHADOW)
+		frame_cairo->title_bar.alternate_dirty |= 1 << component;
+
 	calculate_component_size(frame_cairo, component,
 				 &component_x, &component_y,
 				 &component_width, &component_height);
 
 	set_component_input_region(frame_cairo, border_component);
 
+	if (component == SHADOW) {
+		if (use_shadow_slices(frame_cairo,
+				      component_width, component_height) &&
+		    draw_shadow_slices(frame_cairo,
+				       component_x, component_y,
+				       component_width, component_height))
+			return;
+
+		hide_shadow_slices(frame_cairo);
+	}
+
+	if (component == TITLE && frame_cairo->plugin_cairo->wp_viewporter) {
+		draw_title_bar_parts(frame_cairo, component_x, component_y,
+				     component_width);
+		return;
+	}
+
 	scale = border_component_get_scale(border_component);
-	ensure_component_realized(frame_cairo, border_component,
-				  component_width,
-				  component_height,
-				  scale);
+	if (!ensure_component_realized(frame_cairo, border_component,
+				       component_width,
+				       component_height,
+				       scale))
+		return;
 
 	draw_component_content(frame_cairo,
 			       border_component,
+			       component_x, component_y,
 			       component_width, component_height,
 			       component);
 
-	switch(border_component->composite_mode) {
-	case COMPOSITE_SERVER:
-		buffer = border_component->server.buffer;
-		wl_surface_attach(border_component->server.wl_surface,
-				  buffer->wl_buffer,
-				  0, 0);
-		wl_surface_set_buffer_scale(border_component->server.wl_surface,
-					    buffer->scale);
-		buffer->in_use = true;
-		wl_surface_commit(border_component->server.wl_surface);
-		wl_surface_damage_buffer(border_component->server.wl_surface, 0, 0,
-					 component_width * scale,
-					 component_height * scale);
-		wl_subsurface_set_position(border_component->server.wl_subsurface,
-					   component_x, component_y);
-		break;
-	case COMPOSITE_CLIENT:
-		cr = create_cairo_for_parent(border_component);
-		cairo_set_source_surface(cr,
-					 border_component->client.image,
-					 component_x, component_y);
-		cairo_paint(cr);
-		cairo_destroy(cr);
-		break;
-	}
-
 	wl_list_for_each(child_component, &border_component->child_components, link)
 		draw_border_component(frame_cairo, child_component);
+
+	if (border_component->composite_mode == COMPOSITE_SERVER)
+		commit_server_component(frame_cairo, border_component);
+}
+
+static bool
+can_update_in_place(struct libdecor_frame_cairo *frame_cairo,
+		    struct border_component *border_component)
+{
+	struct buffer *buffer = border_component->server.buffer;
+	int component_x;
+	int component_y;
+	int component_width;
+	int component_height;
+	int scale;
+
+	if (!buffer || buffer->in_use)
+		return false;
+
+	calculate_component_size(frame_cairo, border_component->type,
+				 &component_x, &component_y,
+				 &component_width, &component_height);
+	scale = border_component_get_scale(border_component);
+
+	return (buffer->scale == scale &&
+		buffer->buffer_width == component_width * scale &&
+		buffer->buffer_height == component_height * scale);
+}
+
+static bool
+draw_dirty_server_component(struct libdecor_frame_cairo *frame_cairo,
+			    struct border_component *border_component)
+{
+	struct border_component *child_component;
+	bool children_dirty = false;
+
+	if (border_component->is_hidden)
+		return false;
+
+	if (is_component_dirty(frame_cairo, border_component)) {
+		draw_border_component(frame_cairo, border_component);
+		return true;
+	}
+
+	wl_list_for_each(child_component,
+			 &border_component->child_components, link) {
+		if (is_component_dirty(frame_cairo, child_component))
+			children_dirty = true;
+	}
+	if (!children_dirty)
+		return false;
+
+	/*
+	 * Repaint everything if the previous content is not available to be
+	 * partially updated, e.g. when the compositor still holds the buffer.
+	 */
+	if (!can_update_in_place(frame_cairo, border_component)) {
+		draw_border_component(frame_cairo, border_component);
+		return true;
+	}
+
+	wl_list_for_each(child_component,
+			 &border_component->child_components, link) {
+		if (is_component_dirty(frame_cairo, child_component))
+			draw_border_component(frame_cairo, child_component);
+	}
+	commit_server_component(frame_cairo, border_component);
+
+	return true;
+}
+
+/*
+ * Redraw only the components marked as dirty. Returns true if anything was
+ * redrawn, in which case the toplevel surface needs to be committed.
+ */
+static bool
+draw_dirty_components(struct libdecor_frame_cairo *frame_cairo)
+{
+	bool redrawn = false;
+
+	if (is_border_surfaces_showing(frame_cairo))
+		redrawn |= draw_dirty_server_component(frame_cairo,
+						       &frame_cairo->shadow);
+	if (is_title_bar_surfaces_showing(frame_cairo))
+		redrawn |= draw_dirty_server_component(frame_cairo,
+						       &frame_cairo->title_bar.title);
+
+	frame_cairo->dirty_components = 0;
+	frame_cairo->needs_toplevel_commit = false;
+
+	return redrawn;
+}
+
+static void
+set_component_desync(struct border_component *border_component,
+		     bool desync)
+{
+	if (border_component->is_hidden ||
+	    !border_component->server.wl_subsurface)
+		return;
+
+	if (desync)
+		wl_subsurface_set_desync(border_component->server.wl_subsurface);
+	else
+		wl_subsurface_set_sync(border_component->server.wl_subsurface);
+}
+
+/*
+ * Commit purely cosmetic changes, such as button prelight, without involving
+ * the main surface. The decoration subsurfaces are switched to desynchronized
+ * mode while committing, so that their state is applied immediately. This is
+ * only possible when no decoration state is waiting for the main surface to
+ * be committed, as that would otherwise be applied too early.
+ */
+static void
+draw_cosmetic_changes(struct libdecor_frame_cairo *frame_cairo)
+{
+	if (!frame_cairo->dirty_components)
+		return;
+
+	if (frame_cairo->pending_commit_callback) {
+		if (draw_dirty_components(frame_cairo))
+			libdecor_frame_toplevel_commit(&frame_cairo->frame);
+		return;
+	}
+
+	set_component_desync(&frame_cairo->shadow, true);
+	set_component_desync(&frame_cairo->title_bar.title, true);
+	draw_dirty_components(frame_cairo);
+	set_component_desync(&frame_cairo->shadow, false);
+	set_component_desync(&frame_cairo->title_bar.title, false);
+}
+
+static void
+flush_scheduled_redraws(struct libdecor_plugin_cairo *plugin_cairo)
+{
+	struct libdecor_frame_cairo *frame_cairo, *frame_tmp;
+
+	wl_list_for_each_safe(frame_cairo, frame_tmp,
+			      &plugin_cairo->visible_frame_list, link) {
+		if (!frame_cairo->dirty_components ||
+		    frame_cairo->redraw_callback)
+			continue;
+
+		/* pace the next redraw by the first surface committed */
+		frame_cairo->wants_redraw_callback = true;
+		if (frame_cairo->needs_toplevel_commit) {
+			if (draw_dirty_components(frame_cairo))
+				libdecor_frame_toplevel_commit(&frame_cairo->frame);
+		} else {
+			draw_cosmetic_changes(frame_cairo);
+		}
+		frame_cairo->wants_redraw_callback = false;
+	}
+}
+
+/*
+ * Switch the title bar to the rendering of the opposite activation state. The
+ * title bar drawn for the previous state is kept, so that toggling the
+ * activation state back and forth only re-attaches buffers. Anything drawn
+ * since the alternate buffer was last shown is redrawn into it.
+ */
+static void
+draw_title_bar_activation(struct libdecor_frame_cairo *frame_cairo)
+{
+	struct border_component *title = &frame_cairo->title_bar.title;
+	const uint32_t title_bar_mask = ~(1 << SHADOW);
+	uint32_t state_dirty;
+	struct buffer *buffer;
+
+	if (!is_title_bar_surfaces_showing(frame_cairo) || title->is_hidden) {
+		draw_dirty_components(frame_cairo);
+		return;
+	}
+
+	/* the title bar parts keep the images of both states already */
+	if (frame_cairo->plugin_cairo->wp_viewporter) {
+		mark_component_dirty(frame_cairo, title);
+		draw_dirty_components(frame_cairo);
+		return;
+	}
+
+	/* changes other than the activation state, e.g. maximization */
+	state_dirty = frame_cairo->dirty_components & title_bar_mask;
+
+	buffer = title->server.buffer;
+	title->server.buffer = title->server.alternate_buffer;
+	title->server.alternate_buffer = buffer;
+
+	if (title->server.buffer)
+		frame_cairo->dirty_components |=
+			frame_cairo->title_bar.alternate_dirty;
+	else
+		mark_component_dirty(frame_cairo, title);
+
+	if (!(frame_cairo->dirty_components & title_bar_mask))
+		commit_server_component(frame_cairo, title);
+	draw_dirty_components(frame_cairo);
+
+	/* the previously shown buffer only lacks the other state changes */
+	frame_cairo->title_bar.alternate_dirty = state_dirty;
 }
 
 static void
 draw_border(struct libdecor_frame_cairo *frame_cairo)
 {
-	draw_border_component(frame_cairo, &frame_cairo->shadow);
+	/* set first, the input region is only set on a showing shadow */
 	frame_cairo->shadow_showing = true;
+	draw_border_component(frame_cairo, &frame_cairo->shadow);
 }
 
 static void
@@ -1646,6 +4029,8 @@ draw_decoration(struct libdecor_frame_cairo *frame_cairo)
 	case DECORATION_TYPE_NONE:
 		if (frame_cairo->link.next != NULL)
 			wl_list_remove(&frame_cairo->link);
+		/* hidden surfaces might never see their frame callback done */
+		drop_redraw_callback(frame_cairo);
 		if (is_border_surfaces_showing(frame_cairo))
 			hide_border_surfaces(frame_cairo);
 		if (is_title_bar_surfaces_showing(frame_cairo))
@@ -1678,6 +4063,9 @@ draw_decoration(struct libdecor_frame_cairo *frame_cairo)
 				&frame_cairo->link);
 		break;
 	}
+
+	frame_cairo->dirty_components = 0;
+	frame_cairo->needs_toplevel_commit = false;
 }
 
 static void
@@ -1722,6 +4110,40 @@ window_state_to_decoration_type(enum libdecor_window_state window_state)
 		return DECORATION_TYPE_ALL;
 }
 
+static void
+pending_commit_done(void *user_data,
+		    struct wl_callback *callback,
+		    uint32_t time)
+{
+	struct libdecor_frame_cairo *frame_cairo = user_data;
+
+	wl_callback_destroy(callback);
+	frame_cairo->pending_commit_callback = NULL;
+}
+
+static const struct wl_callback_listener pending_commit_listener = {
+	pending_commit_done
+};
+
+static void
+track_pending_commit(struct libdecor_frame_cairo *frame_cairo)
+{
+	struct wl_surface *wl_surface =
+		libdecor_frame_get_wl_surface(&frame_cairo->frame);
+
+	if (frame_cairo->pending_commit_callback)
+		return;
+
+	/*
+	 * The frame callback becomes part of the pending state of the main
+	 * surface, so it is only done once the application committed it.
+	 */
+	frame_cairo->pending_commit_callback = wl_surface_frame(wl_surface);
+	wl_callback_add_listener(frame_cairo->pending_commit_callback,
+				 &pending_commit_listener,
+				 frame_cairo);
+}
+
 static void
 libdecor_plugin_cairo_frame_commit(struct libdecor_plugin *plugin,
 				   struct libdecor_frame *frame,
@@ -1759,6 +4181,24 @@ libdecor_plugin_cairo_frame_commit(struct libdecor_plugin *plugin,
 	frame_cairo->decoration_type = new_decoration_type;
 	frame_cairo->window_state = new_window_state;
 
+	track_pending_commit(frame_cairo);
+
+	if (old_decoration_type == new_decoration_type &&
+	    old_content_width == new_content_width &&
+	    old_content_height == new_content_height) {
+		/* only the window state changed, keep the geometry */
+		if ((old_window_state ^ new_window_state) &
+		    LIBDECOR_WINDOW_STATE_MAXIMIZED)
+			mark_component_dirty(frame_cairo,
+					     &frame_cairo->title_bar.max);
+		if ((old_window_state ^ new_window_state) &
+		    LIBDECOR_WINDOW_STATE_ACTIVE)
+			draw_title_bar_activation(frame_cairo);
+		else
+			draw_dirty_components(frame_cairo);
+		return;
+	}
+
 	draw_decoration(frame_cairo);
 	set_window_geometry(frame_cairo);
 }
@@ -1769,13 +4209,14 @@ libdecor_plugin_cairo_frame_property_changed(struct libdecor_plugin *plugin,
 {
 	struct libdecor_frame_cairo *frame_cairo =
 		(struct libdecor_frame_cairo *) frame;
-	bool redraw_needed = false;
 	const char *new_title;
 
 	new_title = libdecor_frame_get_title(frame);
-	if (frame_cairo->title_bar.is_showing) {
-		if (!streql(frame_cairo->title, new_title))
-			redraw_needed = true;
+	if (!streql(frame_cairo->title, new_title)) {
+		invalidate_title_layout(frame_cairo);
+		if (frame_cairo->title_bar.is_showing)
+			mark_component_dirty(frame_cairo,
+					     &frame_cairo->title_bar.title);
 	}
 
 	if (frame_cairo->title) {
@@ -1789,13 +4230,10 @@ libdecor_plugin_cairo_frame_property_changed(struct libdecor_plugin *plugin,
 
 	if (frame_cairo->capabilities != libdecor_frame_get_capabilities(frame)) {
 		frame_cairo->capabilities = libdecor_frame_get_capabilities(frame);
-		redraw_needed = true;
+		mark_buttons_dirty(frame_cairo);
 	}
 
-	if (redraw_needed) {
-		draw_decoration(frame_cairo);
-		libdecor_frame_toplevel_commit(frame);
-	}
+	schedule_redraw(frame_cairo, true);
 }
 
 static void
@@ -1984,6 +4422,29 @@ init_wl_subcompositor(struct libdecor_plugin_cairo *plugin_cairo,
 				 id, &wl_subcompositor_interface, 1);
 }
 
+static void
+init_wp_viewporter(struct libdecor_plugin_cairo *plugin_cairo,
+		   uint32_t id,
+		   uint32_t version)
+{
+	plugin_cairo->wp_viewporter =
+		wl_registry_bind(plugin_cairo->wl_registry,
+				 id, &wp_viewporter_interface, 1);
+}
+
+#ifdef HAS_SINGLE_PIXEL_BUFFER
+static void
+init_wp_single_pixel_buffer_manager(struct libdecor_plugin_cairo *plugin_cairo,
+				    uint32_t id,
+				    uint32_t version)
+{
+	plugin_cairo->wp_single_pixel_buffer_manager =
+		wl_registry_bind(plugin_cairo->wl_registry,
+				 id, &wp_single_pixel_buffer_manager_v1_interface,
+				 1);
+}
+#endif
+
 static void
 shm_format(void *user_data,
 	   struct wl_shm *wl_shm,
@@ -2140,16 +4601,21 @@ ensure_cursor_theme(struct seat *seat)
 	return true;
 }
 
-enum libdecor_resize_edge
-component_edge(const struct border_component *cmpnt,
+/* resize edge of the shadow surface at the given shadow coordinates */
+static enum libdecor_resize_edge
+component_edge(struct libdecor_frame_cairo *frame_cairo,
 	       const int pointer_x,
-	       const int pointer_y,
-	       const int margin)
+	       const int pointer_y)
 {
-	const bool top = pointer_y < margin;
-	const bool bottom = pointer_y > (cmpnt->server.buffer->height - margin);
-	const bool left = pointer_x < margin;
-	const bool right = pointer_x > (cmpnt->server.buffer->width - margin);
+	bool top, bottom, left, right;
+
+	/* the shadow surface may not have a buffer of its own size */
+	ensure_layout(frame_cairo);
+
+	top = pointer_y < frame_cairo->layout.edge_top;
+	bottom = pointer_y > frame_cairo->layout.edge_bottom;
+	left = pointer_x < frame_cairo->layout.edge_left;
+	right = pointer_x > frame_cairo->layout.edge_right;
 
 	if (top)
 		if (left)
@@ -2199,9 +4665,9 @@ update_local_cursor(struct seat *seat)
 	    is_border_surfaces_showing(frame_cairo) &&
 	    resizable(frame_cairo)) {
 		enum libdecor_resize_edge edge;
-		edge = component_edge(frame_cairo->active,
+		edge = component_edge(frame_cairo,
 				      seat->pointer_x,
-				      seat->pointer_y, SHADOW_MARGIN);
+				      seat->pointer_y);
 
 		if (edge != LIBDECOR_RESIZE_EDGE_NONE)
 			wl_cursor = seat->cursors[edge - 1];
@@ -2252,8 +4718,9 @@ sync_active_component(struct libdecor_frame_cairo *frame_cairo,
 	old_active = frame_cairo->active;
 	update_component_focus(frame_cairo, seat->pointer_focus, seat);
 	if (old_active != frame_cairo->active) {
-		draw_decoration(frame_cairo);
-		libdecor_frame_toplevel_commit(&frame_cairo->frame);
+		mark_prelight_dirty(frame_cairo, old_active);
+		mark_prelight_dirty(frame_cairo, frame_cairo->active);
+		schedule_redraw(frame_cairo, false);
 	}
 
 	if (update_local_cursor(seat))
@@ -2265,6 +4732,7 @@ synthesize_pointer_enter(struct seat *seat)
 {
 	struct wl_surface *surface;
 	struct libdecor_frame_cairo *frame_cairo;
+	struct border_component *old_active;
 
 	surface = seat->pointer_focus;
 	if (!surface)
@@ -2274,14 +4742,14 @@ synthesize_pointer_enter(struct seat *seat)
 	if (!frame_cairo)
 		return;
 
+	old_active = frame_cairo->active;
 	update_component_focus(frame_cairo, seat->pointer_focus, seat);
 	frame_cairo->grab = NULL;
 
 	/* update decorations */
-	if (frame_cairo->active) {
-		draw_decoration(frame_cairo);
-		libdecor_frame_toplevel_commit(&frame_cairo->frame);
-	}
+	mark_prelight_dirty(frame_cairo, old_active);
+	mark_prelight_dirty(frame_cairo, frame_cairo->active);
+	schedule_redraw(frame_cairo, false);
 
 	update_local_cursor(seat);
 	send_cursor(seat);
@@ -2304,9 +4772,9 @@ synthesize_pointer_leave(struct seat *seat)
 	if (!frame_cairo->active)
 		return;
 
+	mark_prelight_dirty(frame_cairo, frame_cairo->active);
 	frame_cairo->active = NULL;
-	draw_decoration(frame_cairo);
-	libdecor_frame_toplevel_commit(&frame_cairo->frame);
+	schedule_redraw(frame_cairo, false);
 	update_local_cursor(seat);
 }
 
@@ -2416,10 +4884,9 @@ pointer_button(void *data,
 
 			switch (frame_cairo->active->type) {
 			case SHADOW:
-				edge = component_edge(frame_cairo->active,
+				edge = component_edge(frame_cairo,
 						      seat->pointer_x,
-						      seat->pointer_y,
-						      SHADOW_MARGIN);
+						      seat->pointer_y);
 				break;
 			case TITLE:
 				if (time-seat->pointer_button_time_stamp <
@@ -2601,7 +5068,7 @@ output_done(void *data,
 		updated |= redraw_scale(frame_cairo, &frame_cairo->shadow);
 		updated |= redraw_scale(frame_cairo, &frame_cairo->title_bar.title);
 		if (updated)
-			libdecor_frame_toplevel_commit(&frame_cairo->frame);
+			schedule_redraw(frame_cairo, true);
 	}
 	wl_list_for_each(seat, &output->plugin_cairo->seat_list, link) {
 		if (update_local_cursor(seat))
@@ -2672,6 +5139,13 @@ registry_handle_global(void *user_data,
 		init_wl_seat(plugin_cairo, id, version);
 	else if (strcmp(interface, "wl_output") == 0)
 		init_wl_output(plugin_cairo, id, version);
+	else if (strcmp(interface, "wp_viewporter") == 0)
+		init_wp_viewporter(plugin_cairo, id, version);
+#ifdef HAS_SINGLE_PIXEL_BUFFER
+	else if (strcmp(interface,
+			"wp_single_pixel_buffer_manager_v1") == 0)
+		init_wp_single_pixel_buffer_manager(plugin_cairo, id, version);
+#endif
 }
 
 static void
@@ -2787,6 +5261,11 @@ libdecor_plugin_new(struct libdecor *context)
 	wl_list_init(&plugin_cairo->visible_frame_list);
 	wl_list_init(&plugin_cairo->seat_list);
 	wl_list_init(&plugin_cairo->output_list);
+	wl_list_init(&plugin_cairo->button_atlas_list);
+	wl_list_init(&plugin_cairo->shadow_tile_list);
+	wl_list_init(&plugin_cairo->shadow_slice_buffer_list);
+	wl_list_init(&plugin_cairo->solid_buffer_list);
+	wl_list_init(&plugin_cairo->shm_pool_list);
 
 	/* fetch cursor theme and size*/
 	if (!libdecor_get_cursor_settings(&plugin_cairo->cursor_theme_name,
@@ -0,0 +1,111 @@
+/*
+ * Copyright © 2021 Jonas Ådahl
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial
+ * portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Build time generator for the default shadow tile of the cairo plugin.
+ *
+ * Usage: make-shadow-tile OUTPUT
+ *
+ * Writes a C header containing the blurred tile as premultiplied ARGB32
+ * pixels, computed with the same blur_image() the plugin uses at runtime,
+ * for the SHADOW_TILE_* geometry the plugin uses.
+ */
+
+#include "libdecor-cairo-blur-image.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int
+main(int argc, char *argv[])
+{
+	const int size = SHADOW_TILE_SIZE;
+	const int boundary = SHADOW_TILE_BOUNDARY;
+	const int blur_margin = SHADOW_TILE_BLUR_MARGIN;
+	uint32_t *data;
+	int x, y;
+	FILE *file;
+
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s OUTPUT\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	data = calloc(size * size, sizeof *data);
+	if (!data)
+		return EXIT_FAILURE;
+
+	for (y = boundary; y < size - boundary; y++) {
+		for (x = boundary; x < size - boundary; x++)
+			data[y * size + x] = 0xff000000;
+	}
+
+	if (blur_image((uint8_t *) data, size, size,
+		       size * sizeof *data, blur_margin,
+		       BLUR_DEFAULT_RADIUS) < 0) {
+		fprintf(stderr, "Failed to blur shadow tile\n");
+		free(data);
+		return EXIT_FAILURE;
+	}
+
+	file = fopen(argv[1], "w");
+	if (!file) {
+		perror("Failed to open output file");
+		free(data);
+		return EXIT_FAILURE;
+	}
+
+	fprintf(file,
+		"/* Generated by make-shadow-tile, do not edit. */\n"
+		"\n"
+		"#pragma once\n"
+		"\n"
+		"#include <stdint.h>\n"
+		"\n"
+		"/* SHADOW_TILE_SIZE x SHADOW_TILE_SIZE pixels */\n"
+		"static const uint32_t shadow_tile_builtin_data[] = {\n");
+
+	for (y = 0; y < size; y++) {
+		for (x = 0; x < size; x++) {
+			fprintf(file, "%s0x%08x,%s",
+				x % 8 == 0 ? "\t" : " ",
+				data[y * size + x],
+				x % 8 == 7 ? "\n" : "");
+		}
+		if (size % 8 != 0)
+			fprintf(file, "\n");
+	}
+
+	fprintf(file, "};\n");
+
+	free(data);
+
+	if (fclose(file) != 0) {
+		perror("Failed to write output file");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}